@@ -0,0 +1,378 @@
+//  a pool of pre-forked worker processes:
+//  1) fork2.c forks a child per piece of work and wait()s for it;
+//     here the parent forks 'n' workers up front, and keeps them:
+//     a job is a message over a socket, not a fork();
+//  2) a job is a file, or a byte range of one ("path@offset+length"),
+//     and the worker counts its lines and bytes, like wc -lc, and sends that back;
+//  3) a worker that dies (-k makes them) is reaped with waitpid(), its job is
+//     handed to a fresh worker, and the pool stays at 'n' workers.
+//
+//  usage: prefork [-n workers] [-r rangebytes] [-k crashevery] [file[@offset[+length]] ...]
+//  (with no files, the jobs are read from stdin, one per line)
+//  build with: make (or gcc -std=c99 -Wall -Wextra -pedantic prefork.c -o prefork)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // MSG_NOSIGNAL
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define NUM_WORKERS 4   // default number of workers
+#define MAXTRIES 3      // workers a job may take down before we give up on it
+#define BUFSIZE ( 1 << 16 )
+
+// a job: what the parent sends to a worker
+typedef struct job {
+  int id;                // its number
+  char path[PATH_MAX];   // the file
+  long offset;           // where the range starts
+  long length;           // how long it is (-1: to the end of the file)
+} job_t;
+
+// what a worker sends back
+typedef struct result {
+  int id;                // the job's number
+  int err;               // errno if the job failed (0: it didn't)
+  long lines;            // newlines in the range
+  long bytes;            // bytes in the range
+} result_t;
+
+// the parent's view of a worker
+typedef struct worker {
+  pid_t pid;             // its process
+  int sock;              // our end of its socket
+  int job;               // the job it works on (-1: none)
+  long sent;             // when we sent it that job (ns)
+} worker_t;
+
+// the time in ns
+static long
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // now
+
+// count the lines and bytes of the job's range
+static void
+count( const job_t *job, result_t *res ) {
+  static char buf[BUFSIZE];
+  res->id = job->id;
+  res->err = 0;
+  res->lines = res->bytes = 0;
+  int fd = open( job->path, O_RDONLY );
+  if( fd < 0 ) {
+    res->err = errno;
+    return;
+  }
+  long pos = job->offset;
+  for( ; ; ) {
+    size_t want = BUFSIZE;
+    if( job->length >= 0 && (long) want > job->offset + job->length - pos )
+      want = job->offset + job->length - pos;
+    if( want == 0 )
+      break;
+    ssize_t got = pread( fd, buf, want, pos );
+    if( got < 0 ) {
+      res->err = errno;
+      break;
+    }
+    if( got == 0 ) // the end of the file
+      break;
+    for( ssize_t i = 0; i < got; ++i )
+      res->lines += buf[i] == '\n';
+    res->bytes += got;
+    pos += got;
+  }
+  close( fd );
+} // count
+
+// what a worker does: take jobs from 'sock' until the parent closes it,
+// and with 'crashevery' > 0, die on every 'crashevery'-th job instead of doing it
+static void
+work( int sock, int crashevery ) {
+  job_t job;
+  result_t res;
+  int taken = 0;
+  for( ; ; ) {
+    ssize_t n = recv( sock, &job, sizeof(job), 0 );
+    if( n == 0 ) // no more jobs
+      exit( EXIT_SUCCESS );
+    if( n != sizeof(job) ) {
+      perror( "worker: receive job" );
+      exit( EXIT_FAILURE );
+    }
+    if( crashevery > 0 && ++taken % crashevery == 0 )
+      abort( ); // the kind of thing process isolation is for
+    count( &job, &res );
+    if( send( sock, &res, sizeof(res), MSG_NOSIGNAL ) != sizeof(res) ) {
+      perror( "worker: send result" );
+      exit( EXIT_FAILURE );
+    }
+  }
+} // work
+
+// fork worker 'w' of 'n', with a socket of its own
+static void
+spawn( worker_t *workers, int n, int w, int crashevery ) {
+  int sv[2];
+  // SOCK_SEQPACKET keeps the messages apart, and tells us when the other end is gone
+  if( socketpair( AF_UNIX, SOCK_SEQPACKET, 0, sv ) != 0 ) {
+    perror( "socketpair" );
+    exit( EXIT_FAILURE );
+  }
+  fflush( stdout ); // or the child prints what we have buffered, too
+  pid_t cpid = fork( );
+  if( cpid == 0 ) { // child process
+    for( int i = 0; i < n; ++i ) // the other workers' sockets are none of our business
+      if( i != w && workers[i].sock >= 0 )
+	close( workers[i].sock );
+    close( sv[0] );
+    work( sv[1], crashevery );
+  }
+  else if( cpid < 0 ) {
+    perror( "Fork failed" );
+    exit( EXIT_FAILURE );
+  }
+  close( sv[1] );
+  workers[w].pid = cpid;
+  workers[w].sock = sv[0];
+  workers[w].job = -1;
+} // spawn
+
+// reap worker 'w' and tell how it died
+static void
+reap( worker_t *w ) {
+  int status;
+  if( waitpid( w->pid, &status, 0 ) != w->pid ) {
+    perror( "waitpid" );
+    exit( EXIT_FAILURE );
+  }
+  if( WIFSIGNALED( status ) )
+    fprintf( stderr, "[%d] worker killed by signal %d\n", w->pid, WTERMSIG( status ) );
+  else if( WEXITSTATUS( status ) != EXIT_SUCCESS )
+    fprintf( stderr, "[%d] worker exited with %d\n", w->pid, WEXITSTATUS( status ) );
+  close( w->sock );
+  w->sock = -1;
+} // reap
+
+// add the job 'spec' ("path[@offset[+length]]"), cut into ranges of 'range' bytes (0: don't)
+static void
+addjob( job_t **jobs, int *njobs, int *cap, const char *spec, long range ) {
+  long offset = 0, length = -1;
+  size_t plen = strlen( spec );
+  const char *at = strrchr( spec, '@' );
+  if( at ) { // a range, if what follows the '@' is one
+    char *end;
+    long o = strtol( at + 1, &end, 10 ), l = -1;
+    if( *end == '+' )
+      l = strtol( end + 1, &end, 10 );
+    if( end != at + 1 && *end == '\0' && o >= 0 ) {
+      offset = o;
+      length = l;
+      plen = at - spec;
+    }
+  }
+  if( plen >= PATH_MAX ) {
+    fprintf( stderr, "%s: path too long\n", spec );
+    exit( EXIT_FAILURE );
+  }
+  long end = length >= 0 ? offset + length : -1;
+  if( range > 0 && end < 0 ) { // cut up to the end of the file
+    struct stat st;
+    char path[PATH_MAX];
+    memcpy( path, spec, plen );
+    path[plen] = '\0';
+    if( stat( path, &st ) == 0 )
+      end = st.st_size;
+  }
+  do {
+    if( *njobs == *cap && !( *jobs = realloc( *jobs, ( *cap = 2 * *cap + 16 ) * sizeof(job_t) ) ) ) {
+      perror( "allocate jobs" );
+      exit( EXIT_FAILURE );
+    }
+    job_t *job = &(*jobs)[*njobs];
+    job->id = (*njobs)++;
+    memcpy( job->path, spec, plen );
+    job->path[plen] = '\0';
+    job->offset = offset;
+    job->length = range > 0 && end >= 0 && end - offset > range ? range : end >= 0 ? end - offset : -1;
+    offset += range;
+  } while( range > 0 && end >= 0 && offset < end );
+} // addjob
+
+static void
+usage( const char *prog ) {
+  fprintf( stderr, "Usage: %s [-n workers] [-r rangebytes] [-k crashevery] [file[@offset[+length]] ...]\n", prog );
+  exit( EXIT_FAILURE );
+} // usage
+
+int
+main( int argc, char *argv[] ){
+
+  int nworkers = NUM_WORKERS;
+  long range = 0;      // bytes per job (0: a file per job)
+  int crashevery = 0;  // workers die on every so many jobs (0: never)
+  int opt;
+  while( (opt = getopt( argc, argv, "n:r:k:" )) != -1 ) {
+    switch( opt ) {
+    case 'n':
+      nworkers = atoi( optarg );
+      break;
+    case 'r':
+      range = atol( optarg );
+      break;
+    case 'k':
+      crashevery = atoi( optarg );
+      break;
+    default:
+      usage( argv[0] );
+    }
+  }
+  if( nworkers < 1 || range < 0 || crashevery < 0 )
+    usage( argv[0] );
+
+  // the jobs: from the command line, or from stdin
+  job_t *jobs = NULL;
+  int njobs = 0, cap = 0;
+  if( optind < argc )
+    for( int i = optind; i < argc; ++i )
+      addjob( &jobs, &njobs, &cap, argv[i], range );
+  else {
+    char line[PATH_MAX + 64];
+    while( fgets( line, sizeof(line), stdin ) ) {
+      line[strcspn( line, "\n" )] = '\0';
+      if( line[0] != '\0' )
+	addjob( &jobs, &njobs, &cap, line, range );
+    }
+  }
+  result_t *results = calloc( njobs > 0 ? njobs : 1, sizeof(result_t) );
+  int *tries = calloc( njobs > 0 ? njobs : 1, sizeof(int) );  // workers each job took down
+  int *retry = malloc( ( njobs > 0 ? njobs : 1 ) * sizeof(int) );  // jobs to hand out again
+  worker_t *workers = malloc( nworkers * sizeof(worker_t) );
+  struct pollfd *fds = malloc( nworkers * sizeof(struct pollfd) );
+  if( !results || !tries || !retry || !workers || !fds ) {
+    perror( "allocate pool" );
+    exit( EXIT_FAILURE );
+  }
+
+  // start the pool: this is the last time anybody waits for a fork()
+  long start = now( );
+  for( int w = 0; w < nworkers; ++w )
+    workers[w].sock = -1;
+  for( int w = 0; w < nworkers; ++w )
+    spawn( workers, nworkers, w, crashevery );
+  long forkns = now( ) - start;
+  printf( "[%d] %d workers forked in %.1f us (%.1f us each)\n",
+	  getpid( ), nworkers, forkns / 1e3, forkns / 1e3 / nworkers );
+
+  int next = 0;       // next job never handed out
+  int nretry = 0;     // jobs in 'retry'
+  int done = 0;       // jobs finished (or given up on)
+  int respawned = 0;  // workers that died and were replaced
+  long latencyns = 0; // from sending a job to getting its result, for all jobs
+  while( done < njobs ) {
+    // keep every idle worker busy
+    for( int w = 0; w < nworkers; ++w ) {
+      worker_t *wk = &workers[w];
+      if( wk->job >= 0 || ( nretry == 0 && next == njobs ) )
+	continue;
+      wk->job = nretry > 0 ? retry[--nretry] : next++;
+      wk->sent = now( );
+      if( send( wk->sock, &jobs[wk->job], sizeof(job_t), MSG_NOSIGNAL ) != sizeof(job_t) ) {
+	retry[nretry++] = wk->job; // it's dead already: poll() tells us below
+	wk->job = -1;
+      }
+    }
+    for( int w = 0; w < nworkers; ++w ) {
+      fds[w].fd = workers[w].sock;
+      fds[w].events = POLLIN;
+    }
+    if( poll( fds, nworkers, -1 ) < 0 ) {
+      if( errno == EINTR )
+	continue;
+      perror( "poll" );
+      exit( EXIT_FAILURE );
+    }
+    for( int w = 0; w < nworkers; ++w ) {
+      worker_t *wk = &workers[w];
+      if( fds[w].revents == 0 )
+	continue;
+      result_t res;
+      ssize_t n = recv( wk->sock, &res, sizeof(res), MSG_DONTWAIT );
+      if( n == sizeof(res) && res.id == wk->job ) {
+	latencyns += now( ) - wk->sent;
+	results[res.id] = res;
+	wk->job = -1;
+	done++;
+	continue;
+      }
+      if( n < 0 && errno == EAGAIN ) // nothing after all
+	continue;
+      // the worker is gone (or talks nonsense): reap it, and fork another one in its place;
+      // one that is still alive is killed first, or waitpid() would wait for it forever
+      int job = wk->job;
+      kill( wk->pid, SIGKILL ); // ESRCH if it's gone already: never mind
+      reap( wk );
+      spawn( workers, nworkers, w, crashevery );
+      respawned++;
+      if( job < 0 )
+	continue;
+      if( ++tries[job] < MAXTRIES )
+	retry[nretry++] = job;
+      else { // it's the job, not the worker
+	results[job].id = job;
+	results[job].err = ECHILD;
+	done++;
+      }
+    }
+  }
+
+  // no more jobs: closing the sockets tells the workers to exit
+  for( int w = 0; w < nworkers; ++w ) {
+    close( workers[w].sock );
+    workers[w].sock = -1;
+  }
+  for( int w = 0; w < nworkers; ++w )
+    if( waitpid( workers[w].pid, NULL, 0 ) != workers[w].pid )
+      perror( "waitpid" );
+
+  long lines = 0, bytes = 0;
+  int failed = 0;
+  for( int j = 0; j < njobs; ++j ) {
+    const job_t *job = &jobs[j];
+    const result_t *res = &results[j];
+    if( res->err != 0 ) {
+      fprintf( stderr, "%s@%ld: %s\n", job->path, job->offset,
+	       res->err == ECHILD ? "took down every worker that tried it" : strerror( res->err ) );
+      failed++;
+      continue;
+    }
+    printf( "%8ld %10ld %s@%ld+%ld\n", res->lines, res->bytes, job->path, job->offset, res->bytes );
+    lines += res->lines;
+    bytes += res->bytes;
+  }
+  printf( "%8ld %10ld total\n", lines, bytes );
+  printf( "[%d] %d jobs (%d failed) on %d workers, %d respawned, %.1f us per job from send to result\n",
+	  getpid( ), njobs, failed, nworkers, respawned, njobs > 0 ? latencyns / 1e3 / njobs : 0.0 );
+
+  free( jobs );
+  free( results );
+  free( tries );
+  free( retry );
+  free( workers );
+  free( fds );
+  exit( failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS );
+} // main
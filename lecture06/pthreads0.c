@@ -3,11 +3,16 @@
 //     and the data segments as well as the heap,
 //     but each thread has its own stack
 //  2) to show that the order of execution of threads is nondeterministic.
+//  3) with a placement (see ../lecture07/affinity.h), that threads can be pinned
+//     to CPUs: each thread reports the CPU it runs on.
 
+#define _GNU_SOURCE  // sched_getcpu()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include "affinity.h"
 
 // default number of threads
 #define NUM_THREADS  4
@@ -22,12 +27,12 @@ threadfun( void *threadid ){
 
   long tid = (long) threadid; // a variable defined on the thread's stack
   printf( "\nA variable on thread #%lx's stack at: %p\n"
-	  "a global variable at: %p (with value == %d)\nthreadid: %lx\n",
+	  "a global variable at: %p (with value == %d)\nthreadid: %lx on CPU %d\n",
 	 tid, 
 	 (void *) &tid,
 	 (void *) &global, ++global,
-	 (unsigned long) threadid);
-  printf( "%p: %s\n", (void *) shared, shared + tid );
+	 (unsigned long) threadid, sched_getcpu( ));
+  printf( "%p: %s\n", (void *) shared, shared + tid % strlen( shared ) );
   pthread_exit( NULL );
 } // threadfun
 
@@ -44,18 +49,33 @@ main( int argc, char *argv[] ){
 
   shared = targs; // now points to a string on the heap
 
-  pthread_t threads[NUM_THREADS]; // threads
   int nthreads = argc > 1 ? atoi( *++argv ) : NUM_THREADS; // number of threads
   int rc; // return status for pthread_create()
+  affinity_t aff; // where the threads run
+  if( nthreads < 1 || !af_init( &aff, argc > 2 ? argv[1] : NULL ) ) { // 'argv' has moved on to the number of threads
+    fprintf( stderr, "Usage: pthreads0 [threads [" AF_POLICIES "]]\n" );
+    exit( EXIT_FAILURE );
+  }
+  pthread_t *threads = malloc( nthreads * sizeof(pthread_t) ); // as many as asked for
+  if( !threads ) {
+    perror( "allocate threads" );
+    exit( EXIT_FAILURE );
+  }
+  pthread_attr_t attr; // where a thread runs
 
   // create threads
   for( long t = 0; t < nthreads; ++t ){
     printf("\nmain: creating thread %ld\n", t);
-    if( ( rc = pthread_create( &threads[t], NULL, threadfun, (void *) t ) ) ){
+    pthread_attr_init( &attr );
+    af_attr( &aff, t, &attr );
+    rc = pthread_create( &threads[t], &attr, threadfun, (void *) t );
+    pthread_attr_destroy( &attr );
+    if( rc ){
       printf( "ERROR; return code from pthread_create() is %d\n", rc );
       exit( EXIT_FAILURE );
     } // if
   } // for( t = 0; t < nthreads; ++t )
+  af_destroy( &aff );
 
   // last thing main() should do
   pthread_exit( NULL );
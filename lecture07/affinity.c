@@ -0,0 +1,302 @@
+// placement policies for threads, read off the topology in /sys
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // sched_getaffinity(), pthread_attr_setaffinity_np()
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include "errors.h"
+#include "affinity.h"
+
+#define SYSCPU "/sys/devices/system/cpu/cpu%d/%s"
+
+static const char *names[] = { "none", "compact", "scatter", "near", "list" };
+
+// read the number in the file 'what' of CPU 'cpu' ('dflt' if there is none)
+static int
+sysint( int cpu, const char *what, int dflt ) {
+  char path[128];
+  int val;
+  snprintf( path, sizeof(path), SYSCPU, cpu, what );
+  FILE *f = fopen( path, "r" );
+  if( !f )
+    return dflt;
+  if( fscanf( f, "%d", &val ) != 1 )
+    val = dflt;
+  fclose( f );
+  return val;
+} // sysint
+
+// the NUMA node of CPU 'cpu': its directory holds a link "node<n>"
+static int
+sysnode( int cpu ) {
+  char path[128];
+  int node = 0;
+  snprintf( path, sizeof(path), SYSCPU, cpu, "" );
+  DIR *dir = opendir( path );
+  if( !dir )
+    return 0;
+  for( struct dirent *e; (e = readdir( dir )) != NULL; )
+    if( sscanf( e->d_name, "node%d", &node ) == 1 )
+      break;
+  closedir( dir );
+  return node;
+} // sysnode
+
+// the orders the policies fill the CPUs in
+#define CMP(x) if( p->x != q->x ) return p->x - q->x
+
+static int
+bycompact( const void *a, const void *b ) {
+  const af_cpu_t *p = a, *q = b;
+  CMP( node ); CMP( package ); CMP( core ); CMP( smt );
+  return p->cpu - q->cpu;
+} // bycompact
+
+static int
+byscatter( const void *a, const void *b ) {
+  const af_cpu_t *p = a, *q = b;
+  CMP( rank ); CMP( package ); CMP( node );
+  return p->cpu - q->cpu;
+} // byscatter
+
+static int
+bynear( const void *a, const void *b ) {
+  const af_cpu_t *p = a, *q = b;
+  CMP( node ); CMP( smt ); CMP( package ); CMP( core );
+  return p->cpu - q->cpu;
+} // bynear
+
+// cores first: the order in which 'rank' numbers the CPUs of a package
+static int
+byrank( const void *a, const void *b ) {
+  const af_cpu_t *p = a, *q = b;
+  CMP( package ); CMP( smt ); CMP( core );
+  return p->cpu - q->cpu;
+} // byrank
+
+static int
+bycpu( const void *a, const void *b ) {
+  return ( (const af_cpu_t *) a )->cpu - ( (const af_cpu_t *) b )->cpu;
+} // bycpu
+
+// the entry of CPU 'cpu' (NULL: we may not run on it)
+static const af_cpu_t *
+lookup( const af_cpu_t *cpus, int n, int cpu ) {
+  for( int i = 0; i < n; ++i )
+    if( cpus[i].cpu == cpu )
+      return &cpus[i];
+  return NULL;
+} // lookup
+
+bool
+af_init( affinity_t *a, const char *spec ) {
+  cpu_set_t allowed;
+  a->cpus = NULL;
+  a->ncpus = 0;
+  a->policy = AF_NONE;
+  a->saved = NULL;
+  if( !spec || strcmp( spec, "none" ) == 0 )
+    return true;
+  for( int p = AF_COMPACT; p < AF_LIST; ++p )
+    if( strcmp( spec, names[p] ) == 0 )
+      a->policy = p;
+  if( a->policy == AF_NONE && !strchr( "0123456789", spec[0] ) )
+    return false;
+  if( a->policy == AF_NONE )
+    a->policy = AF_LIST;
+
+  // the CPUs we may run on, and where they are
+  if( sched_getaffinity( 0, sizeof(allowed), &allowed ) != 0 )
+    errno_abort( "get affinity" );
+  int n = CPU_COUNT( &allowed );
+  af_cpu_t *cpus = malloc( n * sizeof(af_cpu_t) );
+  if( !cpus )
+    errno_abort( "allocate topology" );
+  n = 0;
+  for( int cpu = 0; cpu < CPU_SETSIZE; ++cpu )
+    if( CPU_ISSET( cpu, &allowed ) ) {
+      af_cpu_t *c = &cpus[n++];
+      c->cpu = cpu;
+      c->package = sysint( cpu, "topology/physical_package_id", 0 );
+      c->core = sysint( cpu, "topology/core_id", cpu );
+      c->node = sysnode( cpu );
+      c->smt = 0;
+      for( int i = 0; i < n - 1; ++i ) // the siblings before us (in the order of their numbers)
+	if( cpus[i].package == c->package && cpus[i].core == c->core )
+	  c->smt++;
+    }
+  qsort( cpus, n, sizeof(af_cpu_t), byrank );
+  for( int i = 0; i < n; ++i )
+    cpus[i].rank = i > 0 && cpus[i-1].package == cpus[i].package ? cpus[i-1].rank + 1 : 0;
+
+  if( a->policy == AF_LIST ) { // the CPUs listed, in the order listed
+    qsort( cpus, n, sizeof(af_cpu_t), bycpu );
+    size_t max = 0; // room in 'list'
+    af_cpu_t *list = NULL;
+    const char *s = spec;
+    char *end;
+    bool ok = false;
+    for( ; ; s = end + 1 ) { // "first[-last]" ranges separated by ','
+      long first = strtol( s, &end, 10 ), last = first;
+      if( end != s && *end == '-' ) {
+	s = end + 1;
+	last = strtol( s, &end, 10 );
+      }
+      if( end == s || last < first ) // not a CPU
+	break;
+      long cpu;
+      for( cpu = first; cpu <= last; ++cpu ) {
+	const af_cpu_t *c = lookup( cpus, n, cpu );
+	if( !c )
+	  break;
+	if( (size_t) a->ncpus == max && !( list = realloc( list, ( max = 2 * max + 8 ) * sizeof(af_cpu_t) ) ) )
+	  errno_abort( "allocate CPU list" );
+	list[a->ncpus++] = *c;
+      }
+      if( cpu <= last ) {
+	fprintf( stderr, "CPU %ld is not one we may run on\n", cpu );
+	break;
+      }
+      if( *end != ',' ) { // the end of the list, or something that doesn't belong there
+	ok = *end == '\0';
+	break;
+      }
+    }
+    free( cpus );
+    a->cpus = list;
+    if( !ok ) {
+      af_destroy( a );
+      return false;
+    }
+    return true;
+  }
+  qsort( cpus, n, sizeof(af_cpu_t),
+	 a->policy == AF_COMPACT ? bycompact : a->policy == AF_SCATTER ? byscatter : bynear );
+  if( a->policy == AF_NEAR ) // only the producer's node
+    while( n > 1 && cpus[n-1].node != cpus[0].node )
+      --n;
+  a->cpus = cpus;
+  a->ncpus = n;
+  return true;
+} // af_init
+
+void
+af_destroy( affinity_t *a ) {
+  free( a->cpus );
+  free( a->saved );
+  a->cpus = a->saved = NULL;
+  a->ncpus = 0;
+  a->policy = AF_NONE;
+} // af_destroy
+
+int
+af_cpu( const affinity_t *a, int slot ) {
+  return a->ncpus > 0 ? a->cpus[slot % a->ncpus].cpu : -1;
+} // af_cpu
+
+void
+af_setcpu( pthread_attr_t *attr, int cpu ) {
+  int rc;
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  CPU_SET( cpu, &set );
+  if( attr )
+    rc = pthread_attr_setaffinity_np( attr, sizeof(set), &set );
+  else
+    rc = pthread_setaffinity_np( pthread_self( ), sizeof(set), &set );
+  if( rc != 0 )
+    err_abort( rc, "set affinity" );
+} // af_setcpu
+
+void
+af_attr( const affinity_t *a, int slot, pthread_attr_t *attr ) {
+  int cpu = af_cpu( a, slot );
+  if( cpu >= 0 )
+    af_setcpu( attr, cpu );
+} // af_attr
+
+// move the calling thread to the node of thread 'slot', and save where it ran before in 'old'
+static void
+tonode( const affinity_t *a, int slot, cpu_set_t *old ) {
+  int rc;
+  const af_cpu_t *c = &a->cpus[slot % a->ncpus];
+  cpu_set_t node;
+  if( (rc = pthread_getaffinity_np( pthread_self( ), sizeof(*old), old )) != 0 )
+    err_abort( rc, "get affinity" );
+  CPU_ZERO( &node ); // any CPU of the node will do
+  for( int i = 0; i < a->ncpus; ++i )
+    if( a->cpus[i].node == c->node )
+      CPU_SET( a->cpus[i].cpu, &node );
+  if( (rc = pthread_setaffinity_np( pthread_self( ), sizeof(node), &node )) != 0 )
+    err_abort( rc, "set affinity" );
+} // tonode
+
+// move the calling thread back to the CPUs 'old'
+static void
+back( const cpu_set_t *old ) {
+  int rc;
+  if( (rc = pthread_setaffinity_np( pthread_self( ), sizeof(*old), old )) != 0 )
+    err_abort( rc, "set affinity" );
+} // back
+
+void
+af_move( affinity_t *a, int slot ) {
+  if( a->ncpus == 0 )
+    return;
+  if( !a->saved && !( a->saved = malloc( sizeof(cpu_set_t) ) ) )
+    errno_abort( "allocate CPU set" );
+  tonode( a, slot, a->saved );
+} // af_move
+
+void
+af_return( affinity_t *a ) {
+  if( a->ncpus > 0 )
+    back( a->saved );
+} // af_return
+
+void
+af_touch( const affinity_t *a, int slot, void *p, size_t len ) {
+  cpu_set_t old;
+  if( a->ncpus == 0 || len == 0 )
+    return;
+  tonode( a, slot, &old ); // (we may be af_move()d already: come back to there)
+  memset( p, 0, len ); // the first touch places the pages
+  back( &old );
+} // af_touch
+
+int
+af_near( const affinity_t *a, int cpu, enum af_distance distance ) {
+  const af_cpu_t *c = lookup( a->cpus, a->ncpus, cpu );
+  if( !c )
+    return -1;
+  if( distance == AF_SAMECPU )
+    return cpu;
+  for( int i = 0; i < a->ncpus; ++i ) {
+    const af_cpu_t *o = &a->cpus[i];
+    if( o->cpu == cpu )
+      continue;
+    if( distance == AF_SMT && o->package == c->package && o->core == c->core )
+      return o->cpu;
+    if( distance == AF_CORE && o->package == c->package && o->core != c->core )
+      return o->cpu;
+    if( distance == AF_PACKAGE && o->package != c->package )
+      return o->cpu;
+  }
+  return -1;
+} // af_near
+
+void
+af_print( const affinity_t *a, int n, FILE *stream ) {
+  fprintf( stream, "placement %s:", names[a->policy] );
+  if( a->ncpus == 0 )
+    fprintf( stream, " wherever the kernel likes" );
+  else
+    for( int slot = 0; slot < n; ++slot )
+      fprintf( stream, " %d", af_cpu( a, slot ) );
+  fprintf( stream, "\n" );
+} // af_print
@@ -0,0 +1,91 @@
+// where threads run: placement policies that pin threads to CPUs,
+// and first-touch placement of the memory they share
+
+#ifndef __affinity_h
+#define __affinity_h
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+  *) by default, the kernel puts a thread wherever it likes, and moves it as it likes:
+     the producer and a consumer may end up on different sockets, and every line
+     they hand over then crosses the interconnect to a remote cache;
+
+  *) af_init() reads the machine's topology (package, core and NUMA node of every CPU
+     we may run on) from /sys/devices/system/cpu, and lines the CPUs up in the order
+     a policy wants them filled; thread 'slot' (0 is the producer, 1, 2, ... the consumers)
+     then runs on the 'slot'-th CPU of that order, wrapping around:
+       compact    SMT siblings first, then the other cores, then the other packages
+                  (the threads share as much cache as they can);
+       scatter    one CPU per package in turn, and one per core before any siblings
+                  (the threads share as little as they can: most cache and memory bandwidth);
+       near       only the producer's node, a core each before any siblings
+                  (the consumers share the producer's last-level cache, not its core);
+       a list     such as "0,2,4-7": the CPUs in that order;
+       none       (or no policy) leave it to the kernel;
+
+  *) memory goes on the node of the thread that will use it: Linux puts a page
+     on the node of the thread that touches it first, so af_move() moves the calling
+     thread over to that node, to allocate and initialize the memory there, and
+     af_return() moves it back; af_touch() does the same for a buffer nobody has
+     initialized yet, by clearing it; this only places pages that were not touched before
+     (a fresh malloc() of a page or more), and is the plain-libc stand-in for
+     libnuma's numa_alloc_onnode();
+
+  *) af_near() finds a CPU at a given distance from another, for benchmarks
+     of what a handoff costs between them
+*/
+
+enum af_policy { AF_NONE, AF_COMPACT, AF_SCATTER, AF_NEAR, AF_LIST };
+
+// how far apart two CPUs are
+enum af_distance {
+  AF_SAMECPU,   // the same CPU
+  AF_SMT,       // SMT siblings: the same core
+  AF_CORE,      // another core of the same package
+  AF_PACKAGE,   // another package (socket)
+};
+
+typedef struct af_cpu {
+  int cpu;      // its number
+  int package;  // its physical package (socket)
+  int core;     // its core in the package
+  int smt;      // its place among the SMT siblings of the core
+  int node;     // its NUMA node
+  int rank;     // its place among the CPUs of its package, cores first
+} af_cpu_t;
+
+typedef struct affinity {
+  enum af_policy policy;
+  af_cpu_t *cpus;  // the CPUs we may run on, in the order threads are placed on them
+  int ncpus;       // number of them
+  void *saved;     // where the thread that af_move()d ran before (a cpu_set_t)
+} affinity_t;
+
+// set up placement by 'spec': "compact", "scatter", "near", "none" or a list of CPUs;
+// return false if 'spec' makes no sense (or lists no CPU we may run on)
+bool af_init( affinity_t *a, const char *spec );
+void af_destroy( affinity_t *a );
+// the CPU of thread 'slot' (-1: not pinned)
+int af_cpu( const affinity_t *a, int slot );
+// pin the thread created with 'attr' to the CPU of thread 'slot' (if any)
+void af_attr( const affinity_t *a, int slot, pthread_attr_t *attr );
+// pin the thread created with 'attr' (NULL: the calling thread) to 'cpu'
+void af_setcpu( pthread_attr_t *attr, int cpu );
+// move the calling thread to the node of thread 'slot' (if it is pinned) ...
+void af_move( affinity_t *a, int slot );
+// ... and back to where it ran before
+void af_return( affinity_t *a );
+// put the pages of 'len' bytes at 'p' on the node of thread 'slot' (if it is pinned)
+void af_touch( const affinity_t *a, int slot, void *p, size_t len );
+// a CPU at 'distance' from 'cpu' (-1: there is none)
+int af_near( const affinity_t *a, int cpu, enum af_distance distance );
+// print how the first 'n' threads are placed to 'stream'
+void af_print( const affinity_t *a, int n, FILE *stream );
+// the policies, for usage messages
+#define AF_POLICIES "compact|scatter|near|none|cpu,cpu-cpu,..."
+
+#endif // __affinity_h
@@ -0,0 +1,34 @@
+// error-reporting macros used by the lecture programs
+// (after D. Butenhof, "Programming with POSIX Threads")
+
+#ifndef __errors_h
+#define __errors_h
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// define DEBUG to get the DPRINTF output
+#ifdef DEBUG
+# define DPRINTF(arg) printf arg
+#else
+# define DPRINTF(arg)
+#endif
+
+// report an error code returned by a pthread_*() function and abort
+#define err_abort(code,text) do { \
+    fprintf( stderr, "%s at \"%s\":%d: %s\n", \
+	     text, __FILE__, __LINE__, strerror( code ) ); \
+    abort( ); \
+  } while( 0 )
+
+// report the error held in 'errno' and abort
+#define errno_abort(text) do { \
+    fprintf( stderr, "%s at \"%s\":%d: %s\n", \
+	     text, __FILE__, __LINE__, strerror( errno ) ); \
+    abort( ); \
+  } while( 0 )
+
+#endif // __errors_h
@@ -0,0 +1,187 @@
+// a micro-benchmark of false sharing: threads that each write a counter of their own
+// (like the consumers' 'carg' and 'outs'), and a writer next to fields that readers
+// read all the time (like the handoff next to the read-mostly fields of so_t),
+// once packed into the same cache lines and once on cache lines of their own;
+// we report the time per iteration and, where perf_event_open(2) lets us,
+// the L1 data cache and last-level cache misses per access
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "errors.h"
+
+#ifndef CACHELINE
+#define CACHELINE 64  // size of a cache line in bytes
+#endif
+
+#define NUM_ITERS 10000000
+#define NUM_THREADS 4
+
+// what a thread does: 'n' stores to, or loads from, the word at 'p'
+typedef struct targ {
+  _Alignas(CACHELINE) atomic_long *p;  // its word
+  bool write;               // store to it (or load from it)
+  long n;                   // that many times
+  long sum;                 // what the loads added up to
+  long ns;                  // how long its loop took
+  pthread_barrier_t *go;    // all threads start together
+} targ_t;
+
+// a case: where thread 't' finds its word, and whether it writes it
+typedef struct layout {
+  const char *name;
+  size_t (*offset)( int t );
+  bool (*writes)( int t );
+} layout_t;
+
+// every thread writes a counter of its own
+static size_t packed( int t ) { return t * sizeof(long); }
+static size_t padded( int t ) { return t * CACHELINE; }
+static bool always( int t ) { (void) t; return true; }
+// thread 0 writes the handoff at the start of the object, the others read a field behind it
+static size_t shared( int t ) { return t == 0 ? 0 : 2 * sizeof(long); }
+static size_t split( int t ) { return t == 0 ? 0 : CACHELINE; }
+static bool first( int t ) { return t == 0; }
+
+static const layout_t layouts[] = {
+  { "counters packed", packed, always },
+  { "counters padded", padded, always },
+  { "so_t packed", shared, first },
+  { "so_t split", split, first },
+};
+
+static long
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // now
+
+// open a counter of this process and the threads it creates from now on (-1: there is none)
+static int
+counter( unsigned type, unsigned long config ) {
+  struct perf_event_attr pe;
+  memset( &pe, 0, sizeof(pe) );
+  pe.size = sizeof(pe);
+  pe.type = type;
+  pe.config = config;
+  pe.disabled = 1;
+  pe.inherit = 1;         // count the threads too
+  pe.exclude_kernel = 1;  // all perf_event_paranoid <= 2 allows
+  pe.exclude_hv = 1;
+  return (int) syscall( __NR_perf_event_open, &pe, 0, -1, -1, 0 );
+} // counter
+
+// print what counter 'fd' counted, per access
+static void
+report( int fd, double accesses ) {
+  long long count;
+  if( fd < 0 || read( fd, &count, sizeof(count) ) != sizeof(count) )
+    printf( " %12s", "-" );
+  else
+    printf( " %12.3f", count / accesses );
+} // report
+
+static void *
+hammer( void *arg ) {
+  targ_t *targ = arg;
+  int rc = pthread_barrier_wait( targ->go );
+  if( rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD )
+    err_abort( rc, "barrier wait" );
+  long start = now( );
+  if( targ->write )
+    for( long i = 0; i < targ->n; ++i )
+      atomic_store_explicit( targ->p, i, memory_order_relaxed );
+  else
+    for( long i = 0; i < targ->n; ++i )
+      targ->sum += atomic_load_explicit( targ->p, memory_order_relaxed );
+  targ->ns = now( ) - start;
+  return NULL;
+} // hammer
+
+// run case 'l' with 'nt' threads of 'n' accesses each, and print a line of the report
+static void
+bench( const layout_t *l, int nt, long n ) {
+  int rc;
+  pthread_t threads[nt];
+  targ_t targ[nt];
+  pthread_barrier_t go;
+  char *mem = aligned_alloc( CACHELINE, ( nt + 1 ) * CACHELINE );
+  if( !mem )
+    errno_abort( "allocate words" );
+  memset( mem, 0, ( nt + 1 ) * CACHELINE );
+  if( (rc = pthread_barrier_init( &go, NULL, nt + 1 )) != 0 )
+    err_abort( rc, "barrier init" );
+  int l1d = counter( PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 )
+		     | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) );
+  int llc = counter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES );
+  if( l1d >= 0 )
+    ioctl( l1d, PERF_EVENT_IOC_ENABLE, 0 );
+  if( llc >= 0 )
+    ioctl( llc, PERF_EVENT_IOC_ENABLE, 0 );
+  for( int t = 0; t < nt; ++t ) {
+    targ[t].p = (atomic_long *) ( mem + l->offset( t ) );
+    targ[t].write = l->writes( t );
+    targ[t].n = n;
+    targ[t].sum = 0;
+    targ[t].go = &go;
+    if( (rc = pthread_create( &threads[t], NULL, hammer, &targ[t] )) != 0 )
+      err_abort( rc, "create thread" );
+  }
+  rc = pthread_barrier_wait( &go ); // they're off
+  if( rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD )
+    err_abort( rc, "barrier wait" );
+  // each thread times its own loop (they may well be done before we get here):
+  // the case takes as long as the slowest of them
+  long total = 0;
+  for( int t = 0; t < nt; ++t ) {
+    if( (rc = pthread_join( threads[t], NULL )) != 0 )
+      err_abort( rc, "join thread" );
+    if( targ[t].ns > total )
+      total = targ[t].ns;
+  }
+  if( l1d >= 0 )
+    ioctl( l1d, PERF_EVENT_IOC_DISABLE, 0 );
+  if( llc >= 0 )
+    ioctl( llc, PERF_EVENT_IOC_DISABLE, 0 );
+  printf( "%-16s %8d %10.2f", l->name, nt, (double) total / n );
+  report( l1d, (double) n * nt );
+  report( llc, (double) n * nt );
+  printf( "\n" );
+  if( l1d >= 0 )
+    close( l1d );
+  if( llc >= 0 )
+    close( llc );
+  pthread_barrier_destroy( &go );
+  free( mem );
+} // bench
+
+int
+main( int argc, char *argv[] ) {
+
+  long n = argc > 1 ? atol( argv[1] ) : NUM_ITERS;        // accesses per thread
+  int nt = argc > 2 ? atoi( argv[2] ) : NUM_THREADS;     // threads
+  if( n <= 0 || nt < 2 ) {
+    fprintf( stderr, "Usage: %s [accesses-per-thread [threads (at least 2)]]\n", argv[0] );
+    exit( EXIT_FAILURE );
+  }
+
+  int probe = counter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES );
+  if( probe < 0 )
+    perror( "no perf counters (perf_event_open), times only" );
+  else
+    close( probe );
+  printf( "%-16s %8s %10s %12s %12s\n", "layout", "threads", "ns/iter", "L1D miss/op", "LLC miss/op" );
+  for( size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l )
+    bench( &layouts[l], nt, n );
+  exit( EXIT_SUCCESS );
+
+} // main
@@ -0,0 +1,104 @@
+// a one-line handoff between a producer and consumers built directly on futex(2)
+
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "errors.h"
+#include "handoff.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause( )
+#else
+#define cpu_relax() atomic_signal_fence( memory_order_seq_cst )
+#endif
+
+#define HO_SPIN 128  // polls of 'state' before going to sleep (with more than one CPU)
+
+// with a single CPU, the other side can't run while we spin: go to sleep right away
+static int spin = HO_SPIN;
+
+#define PRODUCER 1u  // futex bitsets of the two sides
+#define CONSUMER 2u
+
+// sleep as long as 'h->state == val' and nobody wakes up 'who'
+static void
+sleep_on( handoff_t *h, unsigned val, unsigned who ) {
+  if( syscall( SYS_futex, &h->state, FUTEX_WAIT_BITSET_PRIVATE, val, NULL, NULL, who ) != 0
+      && errno != EAGAIN && errno != EINTR )
+    errno_abort( "futex wait" );
+} // sleep_on
+
+// wake up 'n' of the sleepers of side 'who' (if there are any)
+static void
+wake( handoff_t *h, atomic_int *waiting, int n, unsigned who ) {
+  if( atomic_load( waiting ) > 0
+      && syscall( SYS_futex, &h->state, FUTEX_WAKE_BITSET_PRIVATE, n, NULL, NULL, who ) < 0 )
+    errno_abort( "futex wake" );
+} // wake
+
+// wait for 'state' to be different from 'val'
+static void
+wait_change( handoff_t *h, unsigned val, atomic_int *waiting, unsigned who ) {
+  for( int i = 0; i < spin; ++i ) {
+    if( atomic_load_explicit( &h->state, memory_order_acquire ) != val )
+      return;
+    cpu_relax( );
+  }
+  atomic_fetch_add( waiting, 1 );
+  if( atomic_load( &h->state ) == val )
+    sleep_on( h, val, who );
+  atomic_fetch_sub( waiting, 1 );
+} // wait_change
+
+void
+ho_init( handoff_t *h ) {
+  atomic_init( &h->state, HO_EMPTY );
+  atomic_init( &h->pwaiting, 0 );
+  atomic_init( &h->cwaiting, 0 );
+  if( sysconf( _SC_NPROCESSORS_ONLN ) == 1 )
+    spin = 0;
+} // ho_init
+
+// wait for the slot to be empty
+static void
+wait_empty( handoff_t *h ) {
+  unsigned s;
+  while( (s = atomic_load_explicit( &h->state, memory_order_acquire )) != HO_EMPTY )
+    wait_change( h, s, &h->pwaiting, PRODUCER );
+} // wait_empty
+
+void
+ho_put( handoff_t *h, const line_t *item ) {
+  wait_empty( h );
+  // the slot is ours until we say it's full
+  h->slot = *item;
+  atomic_store( &h->state, HO_FULL );
+  wake( h, &h->cwaiting, 1, CONSUMER );
+} // ho_put
+
+bool
+ho_get( handoff_t *h, line_t *item ) {
+  for( ; ; ) {
+    unsigned s = atomic_load_explicit( &h->state, memory_order_acquire );
+    if( s == HO_CLOSED )
+      return false;
+    if( s == HO_FULL && atomic_compare_exchange_strong( &h->state, &s, HO_CLAIMED ) )
+      break;
+    if( s != HO_FULL ) // (a failed compare-and-swap just tries again)
+      wait_change( h, s, &h->cwaiting, CONSUMER );
+  }
+  // we claimed the line: copy it out and free the slot
+  *item = h->slot;
+  atomic_store( &h->state, HO_EMPTY );
+  wake( h, &h->pwaiting, 1, PRODUCER );
+  return true;
+} // ho_get
+
+void
+ho_close( handoff_t *h ) {
+  wait_empty( h );
+  atomic_store( &h->state, HO_CLOSED );
+  wake( h, &h->cwaiting, INT_MAX, CONSUMER );
+} // ho_close
@@ -0,0 +1,61 @@
+// a one-line handoff between a producer and consumers built directly on futex(2)
+
+#ifndef __handoff_h
+#define __handoff_h
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "line.h"
+
+#ifndef CACHELINE
+#define CACHELINE 64  // size of a cache line in bytes
+#endif
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) this is the flag protocol of proNcon2CV.c, with 'flag', 'flaglock' and the two
+     condition variables folded into a single futex word 'state':
+
+    -- HO_EMPTY:   the slot is free; the producer may fill it
+    -- HO_FULL:    the slot holds a line; a consumer may claim it
+    -- HO_CLAIMED: a consumer is copying the line out of the slot
+    -- HO_CLOSED:  no more lines will come
+
+  *) the producer is the only one to turn EMPTY into FULL (a plain store),
+     consumers race for FULL -> CLAIMED with a compare-and-swap, and the winner
+     turns CLAIMED back into EMPTY once it has the line; so a handoff that
+     doesn't have to wait takes no lock and makes no system call at all;
+
+  *) a thread that has to wait spins briefly (unless there is only one CPU), then counts itself in 'pwaiting' or 'cwaiting'
+     and sleeps in FUTEX_WAIT on 'state' for as long as 'state' still has the value it saw;
+     the producer and the consumers sleep on the same word, but with different bitsets,
+     so FUTEX_WAKE_BITSET wakes only the side that can go ahead;
+
+  *) whoever changes 'state' reads the waiting count of the other side afterwards,
+     and only calls futex(2) if it is not 0; a waiter counts itself before it reads 'state',
+     and FUTEX_WAIT rechecks the value in the kernel, so no wakeup is lost
+*/
+
+#define HO_EMPTY   0
+#define HO_FULL    1
+#define HO_CLAIMED 2
+#define HO_CLOSED  3
+
+typedef struct handoff {
+  _Alignas(CACHELINE) atomic_uint state;  // the futex word (see above)
+  atomic_int pwaiting;  // producers asleep on 'state'
+  atomic_int cwaiting;  // consumers asleep on 'state'
+  line_t slot;          // the line handed over
+} handoff_t;
+
+// initialize an empty handoff
+void ho_init( handoff_t *h );
+// producer: wait for the slot to be empty and hand 'item' over
+void ho_put( handoff_t *h, const line_t *item );
+// consumer: wait for a line and take it; return false once the handoff is closed
+bool ho_get( handoff_t *h, line_t *item );
+// producer: wait for the last line to be taken, then let all consumers quit
+void ho_close( handoff_t *h );
+
+#endif // __handoff_h
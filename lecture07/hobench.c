@@ -0,0 +1,226 @@
+// a micro-benchmark of the one-line handoff of the flag protocol:
+// two threads bounce a line back and forth through two handoffs,
+// and we report the round-trip latency in nanoseconds for
+// the mutex+condvar flag of proNcon2CV.c and the futex handoff of handoff.h;
+// the two threads run wherever the kernel puts them, and then pinned (see affinity.h)
+// to the same CPU, to SMT siblings, to two cores of a package, and to two packages,
+// as far as the machine has them: what a handoff costs depends on the caches
+// the line has to travel between
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "errors.h"
+#include "handoff.h"
+#include "affinity.h"
+
+#define NUM_TRIPS 100000
+
+// the flag protocol of proNcon2CV.c: a flag, a mutex, and 2 conditional variables
+typedef struct cvslot {
+  bool flag;                 // the slot is full
+  bool closed;               // no more lines will come
+  line_t slot;               // the line handed over
+  pthread_mutex_t flaglock;  // mutex for 'flag'
+  pthread_cond_t flag_true;  // conditional variable for 'flag == true'
+  pthread_cond_t flag_false; // conditional variable for 'flag == false'
+} cvslot_t;
+
+static void
+cv_init( cvslot_t *c ) {
+  int rc;
+  c->flag = c->closed = false;
+  if( (rc = pthread_mutex_init( &c->flaglock, NULL )) != 0 )
+    err_abort( rc, "mutex init" );
+  if( (rc = pthread_cond_init( &c->flag_true, NULL )) != 0 )
+    err_abort( rc, "flag_true init" );
+  if( (rc = pthread_cond_init( &c->flag_false, NULL )) != 0 )
+    err_abort( rc, "flag_false init" );
+} // cv_init
+
+static void
+cv_destroy( cvslot_t *c ) {
+  pthread_mutex_destroy( &c->flaglock );
+  pthread_cond_destroy( &c->flag_true );
+  pthread_cond_destroy( &c->flag_false );
+} // cv_destroy
+
+static void
+cv_put( cvslot_t *c, const line_t *item, bool close ) {
+  pthread_mutex_lock( &c->flaglock );
+  while( c->flag )
+    pthread_cond_wait( &c->flag_false, &c->flaglock );
+  if( close )
+    c->closed = true;
+  else {
+    c->slot = *item;
+    c->flag = true;
+  }
+  pthread_cond_broadcast( &c->flag_true );
+  pthread_mutex_unlock( &c->flaglock );
+} // cv_put
+
+static bool
+cv_get( cvslot_t *c, line_t *item ) {
+  pthread_mutex_lock( &c->flaglock );
+  while( !c->flag && !c->closed )
+    pthread_cond_wait( &c->flag_true, &c->flaglock );
+  bool got = c->flag;
+  if( got ) {
+    *item = c->slot;
+    c->flag = false;
+    pthread_cond_signal( &c->flag_false );
+  }
+  pthread_mutex_unlock( &c->flaglock );
+  return got;
+} // cv_get
+
+// shared object: a handoff each way, of both kinds
+typedef struct sharedobject {
+  handoff_t ping, pong;  // futex handoffs
+  cvslot_t cping, cpong; // mutex+condvar handoffs
+  long n;                // round trips
+  long *ns;              // latency of every round trip
+} so_t;
+
+static char text[] = "a line to hand over\n";
+
+static long
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // now
+
+// the echo side: hand every line straight back
+void *
+ho_echo( void *arg ) {
+  so_t *so = arg;
+  line_t item;
+  while( ho_get( &so->ping, &item ) )
+    ho_put( &so->pong, &item );
+  return NULL;
+} // ho_echo
+
+void *
+cv_echo( void *arg ) {
+  so_t *so = arg;
+  line_t item;
+  while( cv_get( &so->cping, &item ) )
+    cv_put( &so->cpong, &item, false );
+  return NULL;
+} // cv_echo
+
+// the timing side: send a line and wait for it to come back, 'n' times
+static void
+ho_trips( so_t *so ) {
+  line_t item = { text, sizeof(text) - 1, 0 };
+  for( long i = 0; i < so->n; ++i ) {
+    long start = now( );
+    ho_put( &so->ping, &item );
+    ho_get( &so->pong, &item );
+    so->ns[i] = now( ) - start;
+  }
+  ho_close( &so->ping );
+} // ho_trips
+
+static void
+cv_trips( so_t *so ) {
+  line_t item = { text, sizeof(text) - 1, 0 };
+  for( long i = 0; i < so->n; ++i ) {
+    long start = now( );
+    cv_put( &so->cping, &item, false );
+    cv_get( &so->cpong, &item );
+    so->ns[i] = now( ) - start;
+  }
+  cv_put( &so->cping, NULL, true );
+} // cv_trips
+
+static int
+cmplong( const void *a, const void *b ) {
+  long x = *(const long *) a, y = *(const long *) b;
+  return ( x > y ) - ( x < y );
+} // cmplong
+
+// run one kind of handoff with the echo side on CPU 'cpu' (-1: anywhere), and print its latencies
+static void
+bench( so_t *so, const char *where, int cpu, const char *name, void *(*echo)( void * ), void (*trips)( so_t * ) ) {
+  int rc;
+  pthread_t t;
+  pthread_attr_t attr;
+  if( (rc = pthread_attr_init( &attr )) != 0 )
+    err_abort( rc, "attr init" );
+  if( cpu >= 0 )
+    af_setcpu( &attr, cpu );
+  if( (rc = pthread_create( &t, &attr, echo, so )) != 0 )
+    err_abort( rc, "create echo thread" );
+  pthread_attr_destroy( &attr );
+  long start = now( );
+  trips( so );
+  long total = now( ) - start;
+  if( (rc = pthread_join( t, NULL )) != 0 )
+    err_abort( rc, "join echo thread" );
+  qsort( so->ns, so->n, sizeof(long), cmplong );
+  printf( "%-14s %-16s %10ld %10.0f %10ld %10ld %10ld\n", where, name, so->n, (double) total / so->n,
+	  so->ns[so->n / 2], so->ns[so->n * 99 / 100], so->ns[so->n - 1] );
+} // bench
+
+// run both kinds of handoff with the echo side on CPU 'cpu' (-1: anywhere)
+static void
+placed( so_t *so, const char *where, int cpu ) {
+  ho_init( &so->ping ); // a handoff is closed at the end of a run: start afresh
+  ho_init( &so->pong );
+  cv_init( &so->cping );
+  cv_init( &so->cpong );
+  bench( so, where, cpu, "mutex+condvar", cv_echo, cv_trips );
+  bench( so, where, cpu, "futex", ho_echo, ho_trips );
+  cv_destroy( &so->cping );
+  cv_destroy( &so->cpong );
+} // placed
+
+int
+main( int argc, char *argv[] ) {
+
+  long n = argc > 1 ? atol( argv[1] ) : NUM_TRIPS; // round trips
+  if( n <= 0 ) {
+    fprintf( stderr, "Usage: %s [round-trips]\n", argv[0] );
+    exit( EXIT_FAILURE );
+  }
+
+  so_t *so = aligned_alloc( CACHELINE, sizeof(so_t) );
+  if( !so || !( so->ns = malloc( n * sizeof(long) ) ) )
+    errno_abort( "allocate shared object" );
+  so->n = n;
+
+  affinity_t aff; // where the CPUs are
+  if( !af_init( &aff, "compact" ) )
+    errno_abort( "read topology" );
+  static const struct { const char *name; enum af_distance distance; } placements[] = {
+    { "same CPU", AF_SAMECPU },
+    { "SMT siblings", AF_SMT },
+    { "same package", AF_CORE },
+    { "cross package", AF_PACKAGE },
+  };
+
+  printf( "%-14s %-16s %10s %10s %10s %10s %10s\n",
+	  "placement", "handoff", "trips", "mean ns", "p50 ns", "p99 ns", "max ns" );
+  placed( so, "unpinned", -1 );
+  int here = af_cpu( &aff, 0 ); // the timing side stays here
+  af_setcpu( NULL, here );
+  for( size_t p = 0; p < sizeof(placements) / sizeof(placements[0]); ++p ) {
+    int there = af_near( &aff, here, placements[p].distance );
+    if( there < 0 ) {
+      printf( "%-14s (no such CPUs here)\n", placements[p].name );
+      continue;
+    }
+    placed( so, placements[p].name, there );
+  }
+  af_destroy( &aff );
+
+  free( so->ns );
+  free( so );
+  exit( EXIT_SUCCESS );
+
+} // main
@@ -0,0 +1,136 @@
+// opt-in recording of handoff latencies for the benchmark driver (see pcbench.c)
+
+#ifndef __latency_h
+#define __latency_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+  *) if the environment variable PCBENCH_LAT names a file, lat_init() allocates
+     two time stamps for each of the first LAT_MAXLINES lines: lat_put() stamps a line
+     when the producer hands it over, and lat_get() when a consumer takes it
+     (the first time only: the broken protocols of procon1.c and procon2.c may take a line twice);
+
+  *) lat_dump() writes the number of lines that were taken, and the median and
+     99th percentile of 'taken - handed over' in nanoseconds to that file;
+
+  *) a run that never finishes (procon1.c and procon2.c) is sent SIGTERM at the timeout;
+     lat_init() blocks SIGTERM (before the program creates its threads, which inherit that)
+     and starts a thread that waits for it with sigwait(), dumps what was recorded so far
+     and exits, so the lines handed over up to then are still reported; lat_init() must
+     therefore be called before any other thread is created; a run that finishes cancels
+     that thread in lat_dump(), or it would keep a main() that pthread_exit()s alive;
+
+  *) only one of them writes the file, and it writes it whole: once sigwait() returns,
+     the waiter can no longer be cancelled, and lat_dump() cancels and joins the waiter
+     before it writes, so if SIGTERM came first, main() waits in the join while the waiter
+     dumps and exits, and if main() came first, the waiter is gone before the file is opened;
+
+  *) without PCBENCH_LAT, every hook is a test of a NULL pointer
+*/
+
+#define LAT_MAXLINES ( 1 << 20 )  // most lines to keep time stamps for
+
+static long *lat_putns, *lat_getns;  // time stamps per line number (NULL: not recording)
+static atomic_flag lat_dumped = ATOMIC_FLAG_INIT;  // lat_dump() has run (or is running)
+static pthread_t lat_waiter;  // the thread that waits for SIGTERM
+static bool lat_joined;  // ... and is gone
+
+static inline void lat_dump( void );
+
+static inline long
+lat_now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // lat_now
+
+// the thread that waits for SIGTERM: dump, and leave the way the signal would have
+static inline void *
+lat_onterm( void *arg ) {
+  sigset_t *term = arg;
+  int sig;
+  if( sigwait( term, &sig ) == 0 ) {
+    pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, NULL ); // a lat_dump() of main waits for ours
+    lat_dump( );
+    _exit( 128 + SIGTERM );
+  }
+  return NULL;
+} // lat_onterm
+
+// start recording if PCBENCH_LAT is set
+static inline void
+lat_init( void ) {
+  static sigset_t term;
+  if( !getenv( "PCBENCH_LAT" ) )
+    return;
+  lat_putns = calloc( LAT_MAXLINES, sizeof(long) );
+  lat_getns = calloc( LAT_MAXLINES, sizeof(long) );
+  if( !lat_putns || !lat_getns ) {
+    perror( "allocate latency stamps" );
+    exit( EXIT_FAILURE );
+  }
+  sigemptyset( &term );
+  sigaddset( &term, SIGTERM );
+  if( pthread_sigmask( SIG_BLOCK, &term, NULL ) != 0
+      || pthread_create( &lat_waiter, NULL, lat_onterm, &term ) != 0 ) {
+    perror( "start latency dumper" );
+    exit( EXIT_FAILURE );
+  }
+} // lat_init
+
+// line 'linenum' is being handed over
+static inline void
+lat_put( int linenum ) {
+  if( lat_putns && linenum >= 0 && linenum < LAT_MAXLINES )
+    lat_putns[linenum] = lat_now( );
+} // lat_put
+
+// line 'linenum' has been taken
+static inline void
+lat_get( int linenum ) {
+  if( lat_getns && linenum >= 0 && linenum < LAT_MAXLINES && lat_getns[linenum] == 0 )
+    lat_getns[linenum] = lat_now( );
+} // lat_get
+
+static inline int
+lat_cmp( const void *a, const void *b ) {
+  long x = *(const long *) a, y = *(const long *) b;
+  return ( x > y ) - ( x < y );
+} // lat_cmp
+
+// write "samples p50 p99" to the file named by PCBENCH_LAT
+static inline void
+lat_dump( void ) {
+  if( !lat_putns )
+    return;
+  if( !lat_joined && !pthread_equal( pthread_self( ), lat_waiter ) ) {
+    // the run is over: nobody waits for SIGTERM any more; if the waiter got it already,
+    // it is dumping, and the join waits for it to finish (and to end the process)
+    pthread_cancel( lat_waiter );
+    pthread_join( lat_waiter, NULL );
+    lat_joined = true;
+  }
+  if( atomic_flag_test_and_set( &lat_dumped ) )
+    return;
+  long n = 0;
+  for( long i = 0; i < LAT_MAXLINES; ++i ) // reuse 'lat_putns' for the latencies
+    if( lat_putns[i] && lat_getns[i] )
+      lat_putns[n++] = lat_getns[i] > lat_putns[i] ? lat_getns[i] - lat_putns[i] : 0;
+  qsort( lat_putns, n, sizeof(long), lat_cmp );
+  FILE *f = fopen( getenv( "PCBENCH_LAT" ), "w" );
+  if( f ) {
+    fprintf( f, "%ld %ld %ld\n", n, n ? lat_putns[n / 2] : 0, n ? lat_putns[n * 99 / 100] : 0 );
+    fclose( f );
+  }
+  // the arrays stay: a thread that is still running may stamp another line
+} // lat_dump
+
+#endif // __latency_h
@@ -0,0 +1,14 @@
+// a line handed from a producer to a consumer
+
+#ifndef __line_h
+#define __line_h
+
+#include <stddef.h>
+
+typedef struct line {
+  char *line;   // the text of the line
+  size_t len;   // its length
+  int linenum;  // its line number in the input
+} line_t;
+
+#endif // __line_h
@@ -0,0 +1,42 @@
+// a pool of recycled line buffers
+
+#include <stdlib.h>
+#include <sched.h>
+#include "errors.h"
+#include "linepool.h"
+
+void
+lp_init( linepool_t *pool, size_t nbufs, size_t bufsize ) {
+  if( !( pool->arena = malloc( nbufs * bufsize ) ) )
+    errno_abort( "allocate line pool" );
+  pool->nbufs = nbufs;
+  pool->bufsize = bufsize;
+  pool->free = mpmc_create( nbufs );
+  for( size_t i = 0; i < nbufs; ++i ) // initially, every buffer is free
+    lp_put( pool, pool->arena + i * bufsize );
+} // lp_init
+
+void
+lp_destroy( linepool_t *pool ) {
+  mpmc_destroy( pool->free );
+  free( pool->arena );
+  pool->arena = NULL;
+} // lp_destroy
+
+char *
+lp_get( linepool_t *pool ) {
+  line_t item;
+  // only happens if the pool is smaller than the number of lines in flight
+  while( !mpmc_pop( pool->free, &item ) )
+    sched_yield( );
+  return item.line;
+} // lp_get
+
+void
+lp_put( linepool_t *pool, char *buf ) {
+  line_t item = { buf, 0, 0 };
+  if( !mpmc_push( pool->free, &item ) ) { // can't happen: the queue has room for every buffer
+    fprintf( stderr, "line pool overflow\n" );
+    abort( );
+  }
+} // lp_put
@@ -0,0 +1,40 @@
+// a pool of recycled line buffers:
+// the producer reads lines into buffers taken from the pool,
+// and consumers give them back once they are done with a line
+
+#ifndef __linepool_h
+#define __linepool_h
+
+#include <stddef.h>
+#include "mpmc.h"
+
+/*
+  *) all buffers are carved out of one arena that is allocated once,
+     so there is no malloc()/free() per line;
+
+  *) a line can only be in one of a few places: in the producer's hands,
+     in the queue, or in a consumer's hands; a pool of
+     'queue capacity + consumers + 1' buffers therefore never runs dry,
+     and the memory used is bounded by the queue depth rather than the file size;
+
+  *) the free buffers are kept in a lock-free queue (see mpmc.h),
+     so that getting and putting a buffer never takes a lock
+*/
+
+typedef struct linepool {
+  char *arena;     // 'nbufs' buffers of 'bufsize' bytes each
+  size_t nbufs;    // number of buffers
+  size_t bufsize;  // size of a buffer
+  mpmc_t *free;    // free buffers
+} linepool_t;
+
+// allocate 'nbufs' buffers of 'bufsize' bytes
+void lp_init( linepool_t *pool, size_t nbufs, size_t bufsize );
+// free the arena (all buffers must have been given back)
+void lp_destroy( linepool_t *pool );
+// take a free buffer out of the pool (waits if there is none)
+char *lp_get( linepool_t *pool );
+// give a buffer back to the pool
+void lp_put( linepool_t *pool, char *buf );
+
+#endif // __linepool_h
@@ -0,0 +1,132 @@
+// split a large buffer into lines with SSE2/AVX2 compare-and-movemask
+
+#include <stddef.h>
+#include <string.h>
+#include "linescan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+// an implementation of linescan()
+typedef size_t (*scanfun_t)( const char *, size_t, span_t *, size_t, size_t * );
+
+// the byte-by-byte loop; also finishes the tail the vector versions leave over
+// 'start' is where the current line starts, 'i' is where to continue looking
+static size_t
+scan_tail( const char *buf, size_t n, size_t i, size_t start,
+	   span_t *spans, size_t count, size_t max, size_t *used ) {
+  for( ; i < n && count < max; ++i )
+    if( buf[i] == '\n' ) {
+      spans[count].off = start;
+      spans[count++].len = i + 1 - start;
+      start = i + 1;
+    }
+  *used = start;
+  return count;
+} // scan_tail
+
+static size_t
+scan_scalar( const char *buf, size_t n, span_t *spans, size_t max, size_t *used ) {
+  return scan_tail( buf, n, 0, 0, spans, 0, max, used );
+} // scan_scalar
+
+#ifdef HAVE_X86
+
+// turn the bits of 'mask' (one per '\n' in the block at 'i') into spans;
+// return from the enclosing function once 'spans' is full
+#define EMIT_MASK( mask, i ) do {				\
+    while( mask ) {						\
+      size_t nl = (i) + __builtin_ctz( mask );			\
+      spans[count].off = start;					\
+      spans[count++].len = nl + 1 - start;			\
+      start = nl + 1;						\
+      mask &= mask - 1;						\
+      if( count == max ) {					\
+	*used = start;						\
+	return count;						\
+      }								\
+    }								\
+  } while( 0 )
+
+__attribute__(( target( "sse2" ) ))
+static size_t
+scan_sse2( const char *buf, size_t n, span_t *spans, size_t max, size_t *used ) {
+  const __m128i nls = _mm_set1_epi8( '\n' );
+  size_t count = 0, start = 0, i = 0;
+  if( max == 0 ) {
+    *used = 0;
+    return 0;
+  }
+  for( ; i + 16 <= n; i += 16 ) {
+    __m128i block = _mm_loadu_si128( (const __m128i *) ( buf + i ) );
+    unsigned mask = _mm_movemask_epi8( _mm_cmpeq_epi8( block, nls ) );
+    EMIT_MASK( mask, i );
+  }
+  return scan_tail( buf, n, i, start, spans, count, max, used );
+} // scan_sse2
+
+__attribute__(( target( "avx2" ) ))
+static size_t
+scan_avx2( const char *buf, size_t n, span_t *spans, size_t max, size_t *used ) {
+  const __m256i nls = _mm256_set1_epi8( '\n' );
+  size_t count = 0, start = 0, i = 0;
+  if( max == 0 ) {
+    *used = 0;
+    return 0;
+  }
+  for( ; i + 32 <= n; i += 32 ) {
+    __m256i block = _mm256_loadu_si256( (const __m256i *) ( buf + i ) );
+    unsigned mask = (unsigned) _mm256_movemask_epi8( _mm256_cmpeq_epi8( block, nls ) );
+    EMIT_MASK( mask, i );
+  }
+  return scan_tail( buf, n, i, start, spans, count, max, used );
+} // scan_avx2
+
+#endif // HAVE_X86
+
+// the implementations, best first
+static const struct {
+  const char *name;
+  scanfun_t fun;
+} impls[] = {
+#ifdef HAVE_X86
+  { "avx2", scan_avx2 },
+  { "sse2", scan_sse2 },
+#endif
+  { "scalar", scan_scalar },
+};
+
+static scanfun_t scanfun = NULL;       // the implementation in use
+static const char *scanname = NULL;    // and its name
+
+// is the implementation 'name' supported by this CPU?
+static int
+supported( const char *name ) {
+#ifdef HAVE_X86
+  __builtin_cpu_init( );
+  if( strcmp( name, "avx2" ) == 0 )
+    return __builtin_cpu_supports( "avx2" );
+  if( strcmp( name, "sse2" ) == 0 )
+    return __builtin_cpu_supports( "sse2" );
+#endif
+  return strcmp( name, "scalar" ) == 0;
+} // supported
+
+const char *
+linescan_select( const char *name ) {
+  for( size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i )
+    if( ( !name || strcmp( name, impls[i].name ) == 0 ) && supported( impls[i].name ) ) {
+      scanfun = impls[i].fun;
+      return scanname = impls[i].name;
+    }
+  return NULL;
+} // linescan_select
+
+size_t
+linescan( const char *buf, size_t n, span_t *spans, size_t max, size_t *used ) {
+  if( !scanfun ) // first call: pick the best implementation
+    linescan_select( NULL );
+  return scanfun( buf, n, spans, max, used );
+} // linescan
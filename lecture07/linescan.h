@@ -0,0 +1,36 @@
+// split a large buffer into lines by finding the '\n's
+// 16 (SSE2) or 32 (AVX2) bytes at a time
+
+#ifndef __linescan_h
+#define __linescan_h
+
+#include <stddef.h>
+
+/*
+  *) fgets() + strnlen() look at every byte twice, one byte at a time;
+     linescan() looks at each byte once, comparing a whole vector of bytes
+     against '\n' and turning the result into a bit mask (compare-and-movemask);
+
+  *) the implementation is picked at run time from what the CPU supports
+     (CPUID): AVX2, else SSE2, else a plain byte-by-byte loop;
+
+  *) lines are reported in batches, as spans relative to the start of the buffer
+*/
+
+// a line inside a buffer
+typedef struct span {
+  size_t off;  // offset of the first byte of the line
+  size_t len;  // its length, including the '\n'
+} span_t;
+
+// find up to 'max' complete lines in the 'n' bytes at 'buf' and store them in 'spans';
+// store in 'used' the number of bytes they cover (an incomplete last line is not reported);
+// return the number of lines found
+size_t linescan( const char *buf, size_t n, span_t *spans, size_t max, size_t *used );
+
+// use the implementation called 'name' ("scalar", "sse2" or "avx2"),
+// or the best one the CPU supports if 'name' is NULL;
+// return the name of the implementation in use, or NULL if 'name' is not available
+const char *linescan_select( const char *name );
+
+#endif // __linescan_h
@@ -0,0 +1,175 @@
+// opt-in instrumentation of a mutex and its condition variables:
+// build with 'make CPPFLAGS=-DLOCKSTAT' to count and time them
+
+#ifndef __lockstat_h
+#define __lockstat_h
+
+#include <pthread.h>
+
+/*
+  *) ls_lock(), ls_unlock() and ls_cond_wait() stand in for pthread_mutex_lock(),
+     pthread_mutex_unlock() and pthread_cond_wait(), and return what those return;
+
+  *) with LOCKSTAT defined, every thread keeps its own counts, so the counting
+     adds no sharing of its own: acquisitions, contended acquisitions (the lock was
+     taken when we tried it), condvar waits, and log2 histograms in nanoseconds of
+     how long the lock was held, how long we blocked for it, and how long we sat
+     in pthread_cond_wait(); ls_thread() names the calling thread's counts, and
+     ls_dump() prints those of all the threads once they're joined;
+
+  *) without LOCKSTAT, the calls are the pthread calls, and ls_thread() and
+     ls_dump() are nothing at all
+*/
+
+#ifdef LOCKSTAT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include "errors.h"
+
+#define LS_BUCKETS 40  // bucket 'b' counts times in [2^(b-1), 2^b) ns
+
+typedef struct lockstat {
+  char name[32];                       // whose counts
+  unsigned long acquires;              // times we got the lock
+  unsigned long contended;             // ... and had to block for it
+  unsigned long condwaits;             // times we waited on a condvar
+  long since;                          // when we got the lock (0: not holding it)
+  long holdns, waitns, condns;         // total times
+  unsigned long hold[LS_BUCKETS];      // how long we held the lock
+  unsigned long wait[LS_BUCKETS];      // how long we blocked in ls_lock()
+  unsigned long cond[LS_BUCKETS];      // how long we sat in ls_cond_wait()
+  struct lockstat *next;               // all the threads' counts
+} lockstat_t;
+
+static _Thread_local lockstat_t *ls_self;  // the calling thread's counts
+static lockstat_t *ls_all;                  // every thread's counts
+static pthread_mutex_t ls_alllock = PTHREAD_MUTEX_INITIALIZER;  // mutex for 'ls_all'
+
+static inline long
+ls_now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // ls_now
+
+static inline void
+ls_count( unsigned long hist[], long *total, long ns ) {
+  int b = 0;
+  for( long t = ns; t > 0 && b < LS_BUCKETS - 1; t >>= 1 )
+    ++b;
+  hist[b] += 1;
+  *total += ns;
+} // ls_count
+
+// give the calling thread's counts a name (printf style)
+static inline void
+ls_thread( const char *fmt, ... ) {
+  lockstat_t *s = calloc( 1, sizeof(lockstat_t) );
+  if( !s )
+    errno_abort( "allocate lock statistics" );
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( s->name, sizeof(s->name), fmt, ap );
+  va_end( ap );
+  pthread_mutex_lock( &ls_alllock );
+  s->next = ls_all;
+  ls_all = s;
+  pthread_mutex_unlock( &ls_alllock );
+  ls_self = s;
+} // ls_thread
+
+// the calling thread's counts (an unnamed thread gets them on first use)
+static inline lockstat_t *
+ls_stats( void ) {
+  if( !ls_self )
+    ls_thread( "thread %p", (void *) &ls_self );
+  return ls_self;
+} // ls_stats
+
+static inline int
+ls_lock( pthread_mutex_t *m ) {
+  lockstat_t *s = ls_stats( );
+  int rc = pthread_mutex_trylock( m );
+  if( rc == EBUSY ) { // somebody has it: time how long we block
+    long start = ls_now( );
+    if( (rc = pthread_mutex_lock( m )) != 0 )
+      return rc;
+    s->contended += 1;
+    ls_count( s->wait, &s->waitns, ls_now( ) - start );
+  }
+  else if( rc != 0 )
+    return rc;
+  s->acquires += 1;
+  s->since = ls_now( );
+  return 0;
+} // ls_lock
+
+static inline int
+ls_unlock( pthread_mutex_t *m ) {
+  lockstat_t *s = ls_stats( );
+  if( s->since ) {
+    ls_count( s->hold, &s->holdns, ls_now( ) - s->since );
+    s->since = 0;
+  }
+  return pthread_mutex_unlock( m );
+} // ls_unlock
+
+// the wait gives up the lock, so it ends one hold and starts another
+static inline int
+ls_cond_wait( pthread_cond_t *c, pthread_mutex_t *m ) {
+  lockstat_t *s = ls_stats( );
+  long start = ls_now( );
+  if( s->since )
+    ls_count( s->hold, &s->holdns, start - s->since );
+  int rc = pthread_cond_wait( c, m );
+  s->since = ls_now( );
+  s->condwaits += 1;
+  ls_count( s->cond, &s->condns, s->since - start );
+  return rc;
+} // ls_cond_wait
+
+static inline void
+ls_hist( FILE *stream, const char *what, const unsigned long hist[], long total, unsigned long n ) {
+  fprintf( stream, "  %s: mean %ld ns;", what, n ? total / (long) n : 0 );
+  for( int b = 0; b < LS_BUCKETS; ++b )
+    if( hist[b] )
+      fprintf( stream, " <%ld:%lu", 1L << b, hist[b] );
+  fprintf( stream, "\n" );
+} // ls_hist
+
+// print and forget the counts of every thread; call once they're all joined
+static inline void
+ls_dump( FILE *stream ) {
+  pthread_mutex_lock( &ls_alllock );
+  while( ls_all ) {
+    lockstat_t *s = ls_all;
+    ls_all = s->next;
+    fprintf( stream, "lockstat %s: %lu acquires, %lu contended (%.1f%%), %lu condwaits\n",
+	     s->name, s->acquires, s->contended,
+	     s->acquires ? 100.0 * s->contended / s->acquires : 0.0, s->condwaits );
+    unsigned long holds = 0;
+    for( int b = 0; b < LS_BUCKETS; ++b )
+      holds += s->hold[b];
+    ls_hist( stream, "hold", s->hold, s->holdns, holds );
+    ls_hist( stream, "wait", s->wait, s->waitns, s->contended );
+    ls_hist( stream, "cond", s->cond, s->condns, s->condwaits );
+    free( s );
+  }
+  pthread_mutex_unlock( &ls_alllock );
+} // ls_dump
+
+#else // !LOCKSTAT
+
+#define ls_lock( m ) pthread_mutex_lock( m )
+#define ls_unlock( m ) pthread_mutex_unlock( m )
+#define ls_cond_wait( c, m ) pthread_cond_wait( c, m )
+#define ls_thread( ... ) ( (void) 0 )
+#define ls_dump( stream ) ( (void) 0 )
+
+#endif // LOCKSTAT
+
+#endif // __lockstat_h
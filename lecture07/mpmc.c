@@ -0,0 +1,78 @@
+// a lock-free bounded multi-producer/multi-consumer queue of lines
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "errors.h"
+#include "mpmc.h"
+
+mpmc_t *
+mpmc_create( size_t cap ) {
+  size_t n = 2;
+  while( n < cap )
+    n <<= 1;
+  mpmc_t *q = aligned_alloc( CACHELINE, sizeof(mpmc_t) );
+  if( !q || !( q->cells = malloc( n * sizeof(mpmc_cell_t) ) ) )
+    errno_abort( "allocate mpmc queue" );
+  q->mask = n - 1;
+  for( size_t i = 0; i < n; ++i ) // every cell is free for the first lap
+    atomic_init( &q->cells[i].seq, i );
+  atomic_init( &q->enqpos, 0 );
+  atomic_init( &q->deqpos, 0 );
+  return q;
+} // mpmc_create
+
+void
+mpmc_destroy( mpmc_t *q ) {
+  free( q->cells );
+  free( q );
+} // mpmc_destroy
+
+bool
+mpmc_push( mpmc_t *q, const line_t *item ) {
+  mpmc_cell_t *cell;
+  size_t pos = atomic_load_explicit( &q->enqpos, memory_order_relaxed );
+  for( ; ; ) {
+    cell = &q->cells[pos & q->mask];
+    size_t seq = atomic_load_explicit( &cell->seq, memory_order_acquire );
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+    if( diff == 0 ) { // the cell is free: try to claim position 'pos'
+      if( atomic_compare_exchange_weak_explicit( &q->enqpos, &pos, pos + 1,
+						 memory_order_relaxed, memory_order_relaxed ) )
+	break;
+      // somebody else claimed it; 'pos' now holds the new 'enqpos'
+    }
+    else if( diff < 0 ) // the cell is still full from the previous lap
+      return false;
+    else // another producer got ahead of us
+      pos = atomic_load_explicit( &q->enqpos, memory_order_relaxed );
+  } // for
+  // position 'pos' is ours: fill the cell and publish it
+  cell->item = *item;
+  atomic_store_explicit( &cell->seq, pos + 1, memory_order_release );
+  return true;
+} // mpmc_push
+
+bool
+mpmc_pop( mpmc_t *q, line_t *item ) {
+  mpmc_cell_t *cell;
+  size_t pos = atomic_load_explicit( &q->deqpos, memory_order_relaxed );
+  for( ; ; ) {
+    cell = &q->cells[pos & q->mask];
+    size_t seq = atomic_load_explicit( &cell->seq, memory_order_acquire );
+    intptr_t diff = (intptr_t) seq - (intptr_t) ( pos + 1 );
+    if( diff == 0 ) { // the cell is full: try to claim position 'pos'
+      if( atomic_compare_exchange_weak_explicit( &q->deqpos, &pos, pos + 1,
+						 memory_order_relaxed, memory_order_relaxed ) )
+	break;
+    }
+    else if( diff < 0 ) // the cell has not been filled yet
+      return false;
+    else // another consumer got ahead of us
+      pos = atomic_load_explicit( &q->deqpos, memory_order_relaxed );
+  } // for
+  // position 'pos' is ours: empty the cell and free it for the next lap
+  *item = cell->item;
+  atomic_store_explicit( &cell->seq, pos + q->mask + 1, memory_order_release );
+  return true;
+} // mpmc_pop
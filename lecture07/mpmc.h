@@ -0,0 +1,59 @@
+// a lock-free bounded multi-producer/multi-consumer queue of lines
+// (after D. Vyukov's bounded MPMC queue)
+
+#ifndef __mpmc_h
+#define __mpmc_h
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "line.h"
+
+#ifndef CACHELINE
+#define CACHELINE 64  // size of a cache line in bytes
+#endif
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) every cell carries a sequence number 'seq' next to its line;
+     for the cell at position 'pos' (cell index 'pos & mask'):
+
+    -- seq == pos:
+       the cell is free, and the producer that claims 'pos' may fill it
+
+    -- seq == pos + 1:
+       the cell is full, and the consumer that claims 'pos' may empty it;
+       it then sets seq = pos + cap, freeing the cell for the next lap
+
+  *) producers claim positions by a compare-and-swap on 'enqpos', consumers on 'deqpos',
+     so producers only contend with producers and consumers with consumers,
+     and there is no lock that every consumer has to go through;
+
+  *) push() and pop() never block: they return false if the queue is full (or empty),
+     and the caller decides how to wait
+*/
+
+// a cell of the queue
+typedef struct mpmc_cell {
+  atomic_size_t seq;  // sequence number (see above)
+  line_t item;        // the line in the cell
+} mpmc_cell_t;
+
+typedef struct mpmc {
+  _Alignas(CACHELINE) atomic_size_t enqpos;  // next position to push to (producers)
+  _Alignas(CACHELINE) atomic_size_t deqpos;  // next position to pop from (consumers)
+  _Alignas(CACHELINE) size_t mask;           // capacity - 1 (capacity is a power of 2)
+  mpmc_cell_t *cells;
+} mpmc_t;
+
+// allocate a queue with at least 'cap' cells
+mpmc_t *mpmc_create( size_t cap );
+// free the queue (does not free the lines in it)
+void mpmc_destroy( mpmc_t *q );
+// put a line into the queue; return false if it is full
+bool mpmc_push( mpmc_t *q, const line_t *item );
+// take a line out of the queue; return false if it is empty
+bool mpmc_pop( mpmc_t *q, line_t *item );
+
+#endif // __mpmc_h
@@ -0,0 +1,124 @@
+// a per-thread output buffer that is flushed in large chunks
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "errors.h"
+#include "outbuf.h"
+#include "reorder.h"
+
+// make room for at least 'need' more bytes in the buffer
+static void
+grow( outbuf_t *ob, size_t need ) {
+  while( ob->size - ob->len < need )
+    ob->size *= 2;
+  if( !( ob->buf = realloc( ob->buf, ob->size ) ) )
+    errno_abort( "grow output buffer" );
+} // grow
+
+void
+ob_init( outbuf_t *ob, FILE *stream, size_t size, bool keep ) {
+  ob->stream = stream;
+  ob->size = size > 0 ? size : 1;
+  ob->len = 0;
+  if( !( ob->buf = malloc( ob->size ) ) )
+    errno_abort( "allocate output buffer" );
+  ob->keep = keep;
+  ob->recs = NULL;
+  ob->nrecs = ob->caprecs = 0;
+  ob->sink = NULL;
+} // ob_init
+
+void
+ob_sink( outbuf_t *ob, reorder_t *sink ) {
+  ob->sink = sink;
+} // ob_sink
+
+void
+ob_destroy( outbuf_t *ob ) {
+  if( !ob->keep )
+    ob_flush( ob );
+  free( ob->buf );
+  free( ob->recs );
+  ob->buf = NULL;
+  ob->recs = NULL;
+} // ob_destroy
+
+void
+ob_flush( outbuf_t *ob ) {
+  // a single call, so the whole chunk goes out in one piece
+  if( ob->len > 0 && fwrite( ob->buf, 1, ob->len, ob->stream ) != ob->len )
+    errno_abort( "write output" );
+  ob->len = 0;
+} // ob_flush
+
+void
+ob_printf( outbuf_t *ob, int linenum, const char *fmt, ... ) {
+  va_list ap;
+  va_start( ap, fmt );
+  size_t room = ob->size - ob->len;
+  int n = vsnprintf( ob->buf + ob->len, room, fmt, ap );
+  va_end( ap );
+  if( n < 0 )
+    errno_abort( "format output" );
+  if( (size_t) n >= room ) { // didn't fit: make room and format it again
+    if( !ob->keep )
+      ob_flush( ob );
+    if( ob->size - ob->len <= (size_t) n )
+      grow( ob, n + 1 );
+    va_start( ap, fmt );
+    vsnprintf( ob->buf + ob->len, ob->size - ob->len, fmt, ap );
+    va_end( ap );
+  }
+  if( ob->sink ) { // the sink puts it in order
+    ro_put( ob->sink, linenum, ob->buf + ob->len, n );
+    return;
+  }
+  if( ob->keep ) { // remember where the record is
+    if( ob->nrecs == ob->caprecs ) {
+      ob->caprecs = ob->caprecs ? 2 * ob->caprecs : 1024;
+      if( !( ob->recs = realloc( ob->recs, ob->caprecs * sizeof(outrec_t) ) ) )
+	errno_abort( "grow output records" );
+    }
+    ob->recs[ob->nrecs].linenum = linenum;
+    ob->recs[ob->nrecs].off = ob->len;
+    ob->recs[ob->nrecs++].len = n;
+  }
+  ob->len += n;
+} // ob_printf
+
+// compare records by line number (for qsort())
+static int
+reccmp( const void *a, const void *b ) {
+  const outrec_t *ra = a, *rb = b;
+  return ( ra->linenum > rb->linenum ) - ( ra->linenum < rb->linenum );
+} // reccmp
+
+void
+ob_merge( outbuf_t *obs, int n, FILE *stream ) {
+  outbuf_t out;   // collects the merged output
+  size_t next[n]; // next record of each outbuf
+  ob_init( &out, stream, 1 << 16, false );
+  for( int k = 0; k < n; ++k ) {
+    // records are usually in order already, unless several producers were at work
+    for( size_t r = 1; r < obs[k].nrecs; ++r )
+      if( obs[k].recs[r-1].linenum > obs[k].recs[r].linenum ) {
+	qsort( obs[k].recs, obs[k].nrecs, sizeof(outrec_t), reccmp );
+	break;
+      }
+    next[k] = 0;
+  }
+  for( ; ; ) { // take the record with the smallest line number
+    int best = -1;
+    for( int k = 0; k < n; ++k )
+      if( next[k] < obs[k].nrecs &&
+	  ( best < 0 || obs[k].recs[next[k]].linenum < obs[best].recs[next[best]].linenum ) )
+	best = k;
+    if( best < 0 ) // all records written
+      break;
+    outrec_t *rec = &obs[best].recs[next[best]++];
+    ob_printf( &out, rec->linenum, "%.*s", (int) rec->len, obs[best].buf + rec->off );
+  }
+  ob_destroy( &out );
+} // ob_merge
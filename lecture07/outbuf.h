@@ -0,0 +1,74 @@
+// a per-thread output buffer that is flushed in large chunks
+
+#ifndef __outbuf_h
+#define __outbuf_h
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#ifndef CACHELINE
+#define CACHELINE 64  // size of a cache line in bytes
+#endif
+
+/*
+  *) printf() locks stdout for every call, so threads that print a line each
+     take turns on the stdio lock (and proNcon.c's consumers even print
+     while holding 'flaglock'); instead, each thread formats its output
+     into an outbuf of its own, without any lock, and the whole buffer
+     is handed to a single fwrite() once it is full, so the stdio lock is taken
+     once per buffer rather than once per line (and a chunk that large goes
+     straight to write(2));
+
+  *) a flush only ever writes whole records, so lines from different
+     threads do not get mixed up, nor with what is printf()'ed to the same stream;
+
+  *) in 'keep' mode, nothing is written: the records are kept together with
+     their line numbers, and ob_merge() writes the records of several outbufs
+     in the order of their line numbers once all threads are done;
+
+  *) an outbuf given a sink with ob_sink() hands every record straight to the sink
+     (see reorder.h), which writes the records of all the threads in the order of their
+     line numbers as they come in, holding back no more than its window;
+
+  *) an outbuf starts on a cache line of its own (and fills whole ones), so that
+     the outbufs of several threads can sit next to each other in an array
+     without every record one thread writes taking the line away from the others
+*/
+
+struct reorder;
+
+// a record kept for ob_merge()
+typedef struct outrec {
+  int linenum;  // line number the record belongs to
+  size_t off;   // where it is in the buffer
+  size_t len;   // its length
+} outrec_t;
+
+typedef struct outbuf {
+  _Alignas(CACHELINE) FILE *stream;    // where the output goes
+  char *buf;       // the buffer
+  size_t size;     // its size
+  size_t len;      // bytes in it
+  bool keep;       // keep the records for ob_merge() instead of writing them
+  outrec_t *recs;  // the records kept ('keep' only)
+  size_t nrecs;    // number of records kept
+  size_t caprecs;  // room for records
+  struct reorder *sink;  // where the records go instead (or NULL)
+} outbuf_t;
+
+// initialize an outbuf of 'size' bytes that writes to 'stream'
+void ob_init( outbuf_t *ob, FILE *stream, size_t size, bool keep );
+// hand every record to 'sink' instead of buffering it
+void ob_sink( outbuf_t *ob, struct reorder *sink );
+// write out what is in the buffer (and free it)
+void ob_destroy( outbuf_t *ob );
+// append a record for line 'linenum', formatted like printf()
+void ob_printf( outbuf_t *ob, int linenum, const char *fmt, ... )
+  __attribute__(( format( printf, 3, 4 ) ));
+// write the contents of the buffer to its stream
+void ob_flush( outbuf_t *ob );
+// write the records kept by the 'n' outbufs in 'obs' to 'stream',
+// in the order of their line numbers
+void ob_merge( outbuf_t *obs, int n, FILE *stream );
+
+#endif // __outbuf_h
@@ -0,0 +1,297 @@
+// a benchmark harness for the producer-consumer programs of this directory:
+// it generates input files of 'n' lines of 'len' bytes, runs every protocol on them
+// with 1 to 'c' consumers, and prints one CSV record per run with
+// lines per second, the median and 99th percentile handoff latency (see latency.h),
+// and the CPU time and context switches of the run (from getrusage() via wait4())
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "errors.h"
+
+#define MAXLIST 16         // most entries in a list option
+#define NUM_CONSUMERS 4    // default highest number of consumers
+#define TIMEOUT 5          // default seconds before a run is stopped
+#define GRACE 2            // seconds a stopped run gets to dump its latencies before it is killed
+
+/*
+  *) every protocol is a program and the options to run it with; the programs
+     with 'multi' set take '-c consumers' and run with 1 to 'c' consumers,
+     the others have one consumer;
+
+  *) procon1.c and procon2.c never see the end of their input (their consumers
+     wait for a NULL line that is never handed over), so they are stopped
+     at the timeout and reported as such: they get SIGTERM first, on which they dump
+     the latencies of the lines handed over so far (see latency.h), and SIGKILL
+     if they are still there GRACE seconds later; the 'handed_over' column tells
+     how many lines got across, since their lines per second can't be had
+*/
+typedef struct protocol {
+  const char *name;      // name in the CSV
+  const char *prog;      // program to run
+  const char *args[4];   // its options, NULL terminated
+  bool multi;            // takes '-c consumers'
+} protocol_t;
+
+static const protocol_t protocols[] = {
+  { "procon1", "procon1", { NULL }, false },
+  { "procon2", "procon2", { NULL }, false },
+  { "procon_flag", "procon_flag", { NULL }, false },
+  { "procon_flag-q", "procon_flag", { "-q", "64", NULL }, false },
+  { "proNcon", "proNcon", { NULL }, true },
+  { "proNcon-m", "proNcon", { "-m", "64", NULL }, true },
+  { "proNcon2CV", "proNcon2CV", { NULL }, true },
+  { "proNcon2CV-m", "proNcon2CV", { "-m", "64", NULL }, true },
+  { "proNcon2CV-S", "proNcon2CV", { "-S", "32", NULL }, true },
+  { "proNcon2CV-f", "proNcon2CV", { "-f", NULL }, true },
+  { "proNcon2CV-b", "proNcon2CV", { "-b", "32", NULL }, true },
+};
+
+#define NUM_PROTOCOLS ( sizeof(protocols) / sizeof(protocols[0]) )
+
+// the outcome of one run
+typedef struct result {
+  char status[32];   // "ok", "timeout", "exit N" or "signal N"
+  double seconds;    // wall clock time
+  long samples;      // lines with a latency
+  long p50, p99;     // handoff latency in ns
+  struct rusage ru;  // CPU time and context switches
+} result_t;
+
+static volatile sig_atomic_t expired; // the run took too long
+
+static void
+onalarm( int sig ) {
+  (void) sig;
+  expired = 1;
+} // onalarm
+
+static double
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+} // now
+
+// parse a comma separated list of positive numbers into 'v'; return how many
+static int
+parselist( const char *s, long v[] ) {
+  int n = 0;
+  char *end;
+  do {
+    if( n == MAXLIST )
+      return 0;
+    v[n] = strtol( s, &end, 10 );
+    if( end == s || v[n] <= 0 )
+      return 0;
+    ++n;
+    s = end + 1;
+  } while( *end == ',' );
+  return *end ? 0 : n;
+} // parselist
+
+// write 'lines' lines of 'len' bytes (newline included) to a new temporary file
+static void
+mkinput( char *path, long lines, long len ) {
+  int fd = mkstemp( path );
+  if( fd < 0 )
+    errno_abort( "create input file" );
+  FILE *f = fdopen( fd, "w" );
+  if( !f )
+    errno_abort( "open input file" );
+  for( long i = 0; i < lines; ++i ) {
+    for( long k = 0; k < len - 1; ++k )
+      fputc( 'a' + ( i + k ) % 26, f );
+    fputc( '\n', f );
+  }
+  if( fclose( f ) != 0 )
+    errno_abort( "write input file" );
+} // mkinput
+
+// run protocol 'p' with 'ncons' consumers on file 'input'
+static void
+run( const protocol_t *p, const char *dir, const char *input, int ncons, int timeout, result_t *r ) {
+  char prog[4096], cons[16], latfile[] = "/tmp/pcbench-lat-XXXXXX";
+  const char *argv[10];
+  int argc = 0;
+
+  int fd = mkstemp( latfile );
+  if( fd < 0 )
+    errno_abort( "create latency file" );
+  close( fd );
+
+  snprintf( prog, sizeof(prog), "%s/%s", dir, p->prog );
+  argv[argc++] = prog;
+  for( int i = 0; p->args[i]; ++i )
+    argv[argc++] = p->args[i];
+  if( p->multi ) {
+    snprintf( cons, sizeof(cons), "%d", ncons );
+    argv[argc++] = "-c";
+    argv[argc++] = cons;
+  }
+  argv[argc++] = input;
+  argv[argc] = NULL;
+
+  double start = now( );
+  pid_t pid = fork( );
+  if( pid < 0 )
+    errno_abort( "fork" );
+  if( pid == 0 ) { // the child: quiet, and recording latencies
+    int null = open( "/dev/null", O_WRONLY );
+    if( null < 0 || dup2( null, STDOUT_FILENO ) < 0 || dup2( null, STDERR_FILENO ) < 0 )
+      _exit( 126 );
+    setenv( "PCBENCH_LAT", latfile, 1 );
+    execv( prog, (char **) argv );
+    _exit( 127 );
+  }
+
+  int status;
+  bool stopped = false; // we sent it SIGTERM
+  expired = 0;
+  alarm( timeout );
+  while( wait4( pid, &status, 0, &r->ru ) < 0 ) {
+    if( errno != EINTR )
+      errno_abort( "wait for run" );
+    if( expired && !stopped ) { // time's up: let it dump what it has
+      r->seconds = now( ) - start;
+      kill( pid, SIGTERM );
+      stopped = true;
+      expired = 0;
+      alarm( GRACE );
+    }
+    else if( expired )
+      kill( pid, SIGKILL );
+  }
+  alarm( 0 );
+  if( !stopped )
+    r->seconds = now( ) - start;
+
+  if( stopped )
+    snprintf( r->status, sizeof(r->status), "timeout" );
+  else if( WIFSIGNALED( status ) )
+    snprintf( r->status, sizeof(r->status), "signal %d", WTERMSIG( status ) );
+  else if( WEXITSTATUS( status ) != 0 )
+    snprintf( r->status, sizeof(r->status), "exit %d", WEXITSTATUS( status ) );
+  else
+    snprintf( r->status, sizeof(r->status), "ok" );
+
+  // a run that was killed (or failed) left no latencies
+  r->samples = r->p50 = r->p99 = 0;
+  FILE *f = fopen( latfile, "r" );
+  if( f ) {
+    if( fscanf( f, "%ld %ld %ld", &r->samples, &r->p50, &r->p99 ) != 3 )
+      r->samples = r->p50 = r->p99 = 0;
+    fclose( f );
+  }
+  unlink( latfile );
+} // run
+
+static void
+usage( const char *prog ) {
+  fprintf( stderr, "Usage: %s [-n lines,...] [-l length,...] [-c consumers] [-t seconds] "
+	   "[-p protocol,...] [-d dir] [-o file.csv]\n", prog );
+  fprintf( stderr, "protocols:" );
+  for( size_t i = 0; i < NUM_PROTOCOLS; ++i )
+    fprintf( stderr, " %s", protocols[i].name );
+  fprintf( stderr, "\n" );
+  exit( EXIT_FAILURE );
+} // usage
+
+int
+main( int argc, char *argv[] ) {
+
+  long nlines[MAXLIST] = { 1000, 100000 }, lens[MAXLIST] = { 16, 256 };
+  int nn = 2, nl = 2;
+  int maxcons = NUM_CONSUMERS, timeout = TIMEOUT;
+  const char *only = NULL;  // comma separated protocols to run (NULL: all)
+  const char *dir = ".";    // where the programs are
+  FILE *out = stdout;
+
+  int opt;
+  while( (opt = getopt( argc, argv, "n:l:c:t:p:d:o:" )) != -1 ) {
+    switch( opt ) {
+    case 'n':
+      if( !( nn = parselist( optarg, nlines ) ) )
+	usage( argv[0] );
+      break;
+    case 'l':
+      if( !( nl = parselist( optarg, lens ) ) )
+	usage( argv[0] );
+      break;
+    case 'c':
+      maxcons = atoi( optarg );
+      break;
+    case 't':
+      timeout = atoi( optarg );
+      break;
+    case 'p':
+      only = optarg;
+      break;
+    case 'd':
+      dir = optarg;
+      break;
+    case 'o':
+      if( !( out = fopen( optarg, "w" ) ) )
+	errno_abort( "open output file" );
+      break;
+    default:
+      usage( argv[0] );
+    }
+  }
+  if( optind != argc || maxcons < 1 || timeout < 1 )
+    usage( argv[0] );
+
+  // interrupt wait4() at the timeout
+  struct sigaction sa;
+  memset( &sa, 0, sizeof(sa) );
+  sa.sa_handler = onalarm;
+  sigemptyset( &sa.sa_mask );
+  if( sigaction( SIGALRM, &sa, NULL ) < 0 )
+    errno_abort( "install alarm handler" );
+
+  fprintf( out, "protocol,lines,linelen,consumers,status,seconds,lines_per_sec,"
+	   "handed_over,p50_ns,p99_ns,user_s,sys_s,vcsw,ivcsw\n" );
+  for( int in = 0; in < nn; ++in )
+    for( int il = 0; il < nl; ++il ) {
+      char input[] = "/tmp/pcbench-in-XXXXXX";
+      mkinput( input, nlines[in], lens[il] );
+      for( size_t ip = 0; ip < NUM_PROTOCOLS; ++ip ) {
+	const protocol_t *p = &protocols[ip];
+	if( only ) { // is it on the list?
+	  size_t len = strlen( p->name );
+	  const char *s = only;
+	  while( ( s = strstr( s, p->name ) ) &&
+		 ( ( s != only && s[-1] != ',' ) || ( s[len] && s[len] != ',' ) ) )
+	    s += len;
+	  if( !s )
+	    continue;
+	}
+	for( int c = 1; c <= ( p->multi ? maxcons : 1 ); ++c ) {
+	  result_t r;
+	  run( p, dir, input, c, timeout, &r );
+	  fprintf( out, "%s,%ld,%ld,%d,%s,%.6f,%.0f,%ld,%ld,%ld,%.6f,%.6f,%ld,%ld\n",
+		   p->name, nlines[in], lens[il], c, r.status, r.seconds,
+		   strcmp( r.status, "ok" ) == 0 ? nlines[in] / r.seconds : 0.0, r.samples, r.p50, r.p99,
+		   r.ru.ru_utime.tv_sec + r.ru.ru_utime.tv_usec / 1e6,
+		   r.ru.ru_stime.tv_sec + r.ru.ru_stime.tv_usec / 1e6,
+		   r.ru.ru_nvcsw, r.ru.ru_nivcsw );
+	  fflush( out );
+	}
+      }
+      unlink( input );
+    }
+
+  if( out != stdout )
+    fclose( out );
+  exit( EXIT_SUCCESS );
+
+} // main
@@ -6,10 +6,18 @@
 #include <string.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <unistd.h>
 #include "errors.h"
+#include "mpmc.h"
+#include "linepool.h"
+#include "outbuf.h"
+#include "spinwait.h"
+#include "latency.h"
+#include "lockstat.h"
 
 #define MAXLINE 1000
-#define NUM_CONSUMERS 4
+#define NUM_CONSUMERS 4  // default number of consumers
+#define OUTBUF ( 1 << 16 )  // bytes of output a consumer buffers before it writes them
 
 /*
   COMMMUNICATION MODEL:
@@ -18,6 +26,25 @@
   
   *) 'flaglock' is a mutex that locks the flag;
   
+  *) with '-m slots', the flag and mutex are not used at all: the producer and the consumers
+     share the lock-free queue 'queue' (see mpmc.h), so consumers no longer serialize
+     on 'flaglock'; the producer marks the end of the input with one NULL line per consumer;
+
+  *) nobody spins without end: waittill() and the waits for the queue go through
+     sw_wait() (see spinwait.h), which retries briefly, then yields, then sleeps
+     until release() (or the other side of the queue) calls sw_wake();
+
+  *) 'flaglock' is taken through ls_lock() and ls_unlock() (see lockstat.h): built with
+     LOCKSTAT, every thread counts its acquisitions, contended ones, and how long
+     it held, and waited for, the lock;
+
+  *) either way, lines are read into buffers from 'pool' (see linepool.h),
+     and a consumer gives the buffer back once it is done with the line;
+
+  *) a consumer takes the line and its number out of the shared object
+     and releases the lock before it prints anything; it collects its output
+     in an outbuf of its own (see outbuf.h), which is written out in large chunks
+  
 */
 
 // shared object
@@ -27,8 +54,22 @@ typedef struct sharedobject {
   char *line;   // next line to have read
   bool flag;     // to coordinate between a producer and consumer
   pthread_mutex_t flaglock;  // mutex for 'flag'
+  mpmc_t *queue; // lock-free queue of lines ('-m' only)
+  linepool_t pool; // recycled line buffers
+  int ncons;     // number of consumers
+  spinwait_t full;      // wait for 'flag == true'
+  spinwait_t empty;     // wait for 'flag == false'
+  spinwait_t notfull;   // wait for a free cell in 'queue'
+  spinwait_t notempty;  // wait for a line in 'queue'
 } so_t;
 
+// a condition to retry in sw_wait()
+typedef struct attempt {
+  so_t *so;
+  bool val;      // the value of the flag to wait for
+  line_t *item;  // the line to push or pop
+} attempt_t;
+
 // arguments to consumer threads
 // each thread needs to know it's number (for printing output)
 // plus have access to the shared object
@@ -37,9 +78,9 @@ typedef struct targ {
   so_t *soptr;   // pointer to shared object
 } targ_t;
 
-// read a line from a file and return a new line string object on the heap
+// read a line from a file into a buffer from 'pool'
 // return NULL if no lines to read
-char *readline( FILE *rfile );
+char *readline( FILE *rfile, linepool_t *pool );
 // wait till the flag gets a value == val
 bool waittill( so_t *so, bool val );
 // release the lock on shared object
@@ -48,48 +89,83 @@ int release( so_t *so );
 void *producer( void *arg );
 // remove lines from the shared buffer
 void *consumer( void *arg );
+// read lines from a file, push them into the lock-free queue
+void *mproducer( void *arg );
+// pop lines from the lock-free queue
+void *mconsumer( void *arg );
 
 int
 main( int argc, char *argv[] ) {
 
+  size_t slots = 0; // capacity of the lock-free queue; 0 for the flag protocol
+  int ncons = NUM_CONSUMERS; // number of consumers
+  int opt;
+  while( (opt = getopt( argc, argv, "m:c:" )) != -1 ) {
+    switch( opt ) {
+    case 'm':
+      slots = strtoul( optarg, NULL, 10 );
+      break;
+    case 'c':
+      ncons = atoi( optarg );
+      break;
+    default:
+      fprintf( stderr, "Usage: %s [-m slots] [-c consumers] filename\n", argv[0] );
+      exit( EXIT_FAILURE );
+    }
+  }
+
   // check use
-  if( argc < 2 ){
-    fprintf( stderr, "Usage: %s filename\n", argv[0] );
+  if( optind >= argc || ncons < 1 ){
+    fprintf( stderr, "Usage: %s [-m slots] [-c consumers] filename\n", argv[0] );
     exit( EXIT_FAILURE );
   }
 
+  lat_init( ); // record handoff latencies for pcbench (if asked to)
+
   // open a file
-  FILE * rfile = fopen( (char *) argv[1], "r" );
+  FILE * rfile = fopen( argv[optind], "r" );
   if( !rfile ) {
-    printf( "error opening %s\n", argv[0] );
+    printf( "error opening %s\n", argv[optind] );
     exit( EXIT_FAILURE );
   }
 
   int rc = 0; // return code
   
-  // shared object
-  so_t *share = malloc( sizeof(so_t) );
+  // shared object (the waits sit on cache lines of their own)
+  so_t *share = aligned_alloc( CACHELINE, sizeof(so_t) );
+  if( !share )
+    errno_abort( "allocate shared object" );
   // initialize the shared object
   share->rfile = rfile;
+  share->ncons = ncons;
+  sw_init( &share->full );
+  sw_init( &share->empty );
+  sw_init( &share->notfull );
+  sw_init( &share->notempty );
   share->line = NULL;
   share->flag = false; // initially, the buffer is empty
+  share->queue = slots > 0 ? mpmc_create( slots ) : NULL;
+  // lines in flight: the queue (or the buffer), one per consumer, one being read
+  lp_init( &share->pool, ( slots > 0 ? share->queue->mask + 1 : 1 ) + ncons + 1, MAXLINE );
+  void *(*prodfun)( void * ) = slots > 0 ? mproducer : producer;
+  void *(*consfun)( void * ) = slots > 0 ? mconsumer : consumer;
   // initialize mutex; starts off unlocked
   if( ( rc = pthread_mutex_init( &share->flaglock, NULL ) ) != 0 )
     err_abort( rc, "mutex init" );
   
   pthread_t prod;                 // producer thread
-  pthread_t cons[NUM_CONSUMERS];  // consumer threads
-  targ_t carg[NUM_CONSUMERS];     // arguments to consumer threads
+  pthread_t cons[ncons];  // consumer threads
+  targ_t carg[ncons];     // arguments to consumer threads
 
   // create producer thread
-  if( ( rc = pthread_create( &prod, NULL, producer, (void *) share ) ) != 0 )
+  if( ( rc = pthread_create( &prod, NULL, prodfun, (void *) share ) ) != 0 )
     err_abort( rc, "create producer thread" );
   
   // create consumer threads
-  for( int i = 0; i < NUM_CONSUMERS; ++i ) {
+  for( int i = 0; i < ncons; ++i ) {
     carg[i].tid = i;
     carg[i].soptr = share;
-    if( ( rc =  pthread_create( &cons[i], NULL, consumer, &carg[i]) ) != 0 )
+    if( ( rc =  pthread_create( &cons[i], NULL, consfun, &carg[i]) ) != 0 )
       err_abort( rc, "create consumer thread" );
   } // for
 
@@ -101,39 +177,75 @@ main( int argc, char *argv[] ) {
     err_abort( rc, "join producer thread" );
   printf( "main: producer joined with %d lines produced \n", *((int *) ret) );
   
-  for (int i = 0; i < NUM_CONSUMERS; ++i) {
+  for (int i = 0; i < ncons; ++i) {
     if( ( rc = pthread_join( cons[i], (void **) &ret ) ) != 0)
     err_abort( rc, "join consumer thread" );
     printf( "main: consumer %d joined with %d lines consumed \n", i, *((int *) ret) );
-  } // for 
+  } // for
+  if( share->queue ) {
+    sw_report( &share->notfull, "main: producer" );
+    sw_report( &share->notempty, "main: consumers" );
+  }
+  else {
+    sw_report( &share->empty, "main: producer" );
+    sw_report( &share->full, "main: consumers" );
+  }
+  lat_dump( );
+  ls_dump( stdout );
 
   // destroy mutex
   if( ( rc = pthread_mutex_destroy( &share->flaglock ) ) != 0)
     err_abort( rc, "destroy mutex" );
+  if( share->queue )
+    mpmc_destroy( share->queue );
+  lp_destroy( &share->pool );
   free( share );  // destroy shared object
   pthread_exit( NULL );
 
 } // main
 
+// is the flag 'val'? if so, return with the object locked
+static bool
+flagis( void *arg ) {
+  attempt_t *a = arg;
+  int rc;
+  if( ( rc = ls_lock( &a->so->flaglock ) ) != 0 ) // gain access to the object
+    err_abort( rc, "lock mutex" );
+  if( a->so->flag == a->val ) // check the flag
+    return true; // return with the object locked
+  if( ( rc = ls_unlock( &a->so->flaglock ) ) != 0 ) // unlock for others
+    err_abort( rc, "unlock mutex" );
+  return false;
+} // flagis
+
+static bool
+trypush( void *arg ) {
+  attempt_t *a = arg;
+  return mpmc_push( a->so->queue, a->item );
+} // trypush
+
+static bool
+trypop( void *arg ) {
+  attempt_t *a = arg;
+  return mpmc_pop( a->so->queue, a->item );
+} // trypop
+
 // are we waiting for the value of the flag to change to 'val'?
 bool
 waittill( so_t *so, bool val ) {
-  // spin as long as flag != val 
-  for( ; ; ) { // forever
-    int rc;
-    if( ( rc = pthread_mutex_lock( &so->flaglock  ) ) != 0 ) // gain access to the object
-      err_abort( rc, "lock mutex" );
-    if( so->flag == val ) // check the flag
-      return true; // return with the object locked
-    if( ( rc = pthread_mutex_unlock( &so->flaglock  ) ) != 0 ) // unlock for others
-      err_abort( rc, "unlock mutex" );
-  } // for 
+  // check as long as flag != val, spinning at first, sleeping later
+  attempt_t a = { so, val, NULL };
+  sw_wait( val ? &so->full : &so->empty, flagis, &a );
+  return true; // return with the object locked
 } // waittill
 
 // release the lock; return the return code of 'pthread_mutex_unlock'
 int
 release( so_t *so ) {
-  return pthread_mutex_unlock( &so->flaglock );
+  bool flag = so->flag;
+  int rc = ls_unlock( &so->flaglock );
+  sw_wake( flag ? &so->full : &so->empty ); // whoever waits for this value may go ahead
+  return rc;
 }
 
 // function executed by the producer thread
@@ -144,13 +256,15 @@ producer( void *arg ) {
   int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
   int i = 0; // to count lines produced
   char *line; // next line
+  ls_thread( "Prod" );
   // read a line from the file; keep going while there are lines to read
-  while ( ( line = readline( so->rfile ) ) ) {
+  while ( ( line = readline( so->rfile, &so->pool ) ) ) {
     waittill( so, false );	// wait untill the buffer is empty and acquire the lock
     // we're holding the lock
     so->linenum = i;		
     so->line = line;		// put the line into the shared buffer
     so->flag = true;		// set the flag
+    lat_put( i );
     fprintf( stdout, "Prod: [%d] %s", i++, line );
     if( (rc = release( so )) != 0)		// release the lock
       err_abort( rc, "unlock mutex" );
@@ -176,14 +290,23 @@ consumer( void *arg ) {
   int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
   int i = 0;
   char *line;
+  int linenum;
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  ls_thread( "Cons %ld", tid );
   printf("Consumer %ld starting\n", tid);
   while( waittill( so, true ) && ( line = so->line ) ) { 
     // we're holding the lock
-    printf( "Consumer %ld: [%d:%d] %s", tid, i++, so->linenum, line );
+    linenum = so->linenum;
+    lat_get( linenum );
     so->flag = false;  // we've consumed the pending line; set the flag accordingly
     if( (rc = release( so )) != 0)	   // release the lock
       err_abort( rc, "unlock mutex" );
+    // the line is ours now: print it without holding the lock
+    ob_printf( &out, linenum, "Consumer %ld: [%d:%d] %s", tid, i++, linenum, line );
+    lp_put( &so->pool, line );  // we're done with the line: recycle its buffer
   }
+  ob_destroy( &out ); // write out the rest of our output
   // if we're here, we're holding the lock; the loop failed since line == NULL
   printf("Consumer %ld: %d lines\n", tid, i);
   if( ( rc = release( so ) ) != 0)	   // release the lock, so that other consumer may finish
@@ -192,17 +315,75 @@ consumer( void *arg ) {
   pthread_exit( ret );
 } // consumer
 
+// function executed by the producer thread with '-m'
+void *
+mproducer( void *arg ) {
+  so_t *so = (so_t *) arg;
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
+  int i = 0; // to count lines produced
+  line_t item; // next line
+  attempt_t push = { so, false, &item };
+  printf("Producer starting\n");
+  while ( (item.line = readline( so->rfile, &so->pool )) ) {
+    item.len = strlen( item.line );
+    item.linenum = i++;
+    fprintf( stdout, "Prod: [%d] %s", item.linenum, item.line );
+    lat_put( item.linenum );
+    if( !mpmc_push( so->queue, &item ) ) // the queue is full: wait for the consumers
+      sw_wait( &so->notfull, trypush, &push );
+    sw_wake( &so->notempty );
+  }
+  // allow every consumer's loop to quit
+  item.line = NULL;
+  for( int c = 0; c < so->ncons; ++c ) {
+    if( !mpmc_push( so->queue, &item ) )
+      sw_wait( &so->notfull, trypush, &push );
+    sw_wake( &so->notempty );
+  }
+  printf( "Prod: %d lines\n", i );
+  *ret = i;
+  pthread_exit( ret );
+} // mproducer
+
+// function executed by a consumer thread with '-m'
+void *
+mconsumer( void *arg ) {
+  targ_t *targ = (targ_t *) arg;
+  long tid = targ->tid;    // thread's 'id'
+  so_t *so = targ->soptr;  // shared object
+  int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
+  int i = 0;
+  size_t len = 0;
+  line_t item;
+  attempt_t pop = { so, false, &item };
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  printf("Consumer %ld starting\n", tid);
+  for( ; ; ) {
+    if( !mpmc_pop( so->queue, &item ) ) // the queue is empty: wait for the producer
+      sw_wait( &so->notempty, trypop, &pop );
+    sw_wake( &so->notfull );
+    if( !item.line ) // no more lines
+      break;
+    lat_get( item.linenum );
+    len += item.len;
+    ob_printf( &out, item.linenum, "Consumer %ld: [%d:%d] %s", tid, i++, item.linenum, item.line );
+    lp_put( &so->pool, item.line ); // recycle the buffer
+  }
+  ob_destroy( &out ); // write out the rest of our output
+  printf( "Cons %ld: %d lines, %zu bytes\n", tid, i, len );
+  *ret = i;
+  pthread_exit( ret );
+} // mconsumer
+
 char *
-readline( FILE *rfile ) {
-  /* Read a line from a file and return a new line string object */
-  char buf[MAXLINE];
-  int len;
-  char *result = NULL;
-  char *line = fgets( buf, MAXLINE, rfile );
-  if( line ) {
-    len = strnlen( buf, MAXLINE );
-    result = strncpy( malloc( len+1 ), buf , len+1 );
+readline( FILE *rfile, linepool_t *pool ) {
+  /* Read a line from a file into a buffer from the pool */
+  char *buf = lp_get( pool );
+  if( !fgets( buf, MAXLINE, rfile ) ) {
+    lp_put( pool, buf ); // nothing read: the buffer goes back
+    return NULL;
   }
-  return result;
+  return buf;
 }
 
@@ -6,10 +6,30 @@
 #include <pthread.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
 #include "errors.h"
+#include "mpmc.h"
+#include "linepool.h"
+#include "outbuf.h"
+#include "reorder.h"
+#include "wsq.h"
+#include "handoff.h"
+#include "spinwait.h"
+#include "latency.h"
+#include "lockstat.h"
+#include "trace.h"
+#include "work.h"
+#include "affinity.h"
 
 #define MAXLINE 1000
-#define NUM_CONSUMERS 4
+#define NUM_CONSUMERS 4  // default number of consumers
+#define MAXBATCH 256  // most lines dealt to a deque at a time ('-S')
+#define WS_DEPTH 4    // batches each deque holds ('-S')
+#define OUTBUF ( 1 << 16 )  // bytes of output a consumer buffers before it writes them
+#define REORDER_WINDOW 4096  // default number of lines the ordered output may hold back ('-o')
+#define BATCH_BYTES ( 64 << 10 )  // default number of bytes the producer batches up ('-b')
+#define BATCH_NSEC 1000000  // most time (ns) the producer should spend filling a batch ('-b')
 
 /*
   COMMMUNICATION MODEL:
@@ -26,57 +46,292 @@
 
     -- flag_false:
        consumer -> producer:  'flag' is now false, so go ahead and do your job
+
+  *) the flag protocol moves one line per lock acquisition (and per signal): it is the baseline;
+
+  *) with '-b batch', the buffer holds a batch of lines instead ('lines', 'nlines'), so the lock
+     is taken (and the condvar signalled) once per batch on either side: the producer collects
+     up to 'batch' lines (or '-B batchbytes' bytes) before it waits for the flag to be 'false',
+     and a consumer copies the whole batch out before it sets the flag back;
+     as in proNconQ.c, the producer adapts its batch size to the rate at which lines come in:
+     it halves it whenever filling a batch took longer than BATCH_NSEC, and doubles it
+     (up to 'batch') otherwise; 'nlines == 0' with the flag 'true' marks the end of the input;
+
+  *) with '-m slots', the flag, mutex and condvars are not used at all: the producer and the consumers
+     share the lock-free queue 'queue' (see mpmc.h), so consumers no longer serialize
+     on 'flaglock'; the producer marks the end of the input with one NULL line per consumer;
+     a side that finds the queue full (or empty) waits in sw_wait() (see spinwait.h), as in proNcon.c,
+     rather than spinning on sched_yield(), so an idle consumer sleeps instead of burning a CPU;
+
+  *) with '-S batch', the consumers don't share anything but the producer: it deals
+     the lines out in batches of 'batch', round robin, to a deque per consumer, and a consumer
+     that has emptied its own deque steals from the others (see wsq.h);
+     the line counts of the consumers show how evenly the work was spread;
+
+  *) with '-f', the flag, mutex and condvars are replaced by 'ho', a handoff built
+     directly on a futex (see handoff.h): the same one-line protocol, but a handoff
+     that doesn't have to wait takes no lock and makes no system call;
+
+  *) the flag protocol takes and waits on 'flaglock' through ls_lock() and ls_cond_wait()
+     (see lockstat.h): built with LOCKSTAT, every thread counts its acquisitions,
+     contended ones, and how long it held, and waited for, the lock;
+
+  *) with PCTRACE=file.json in the environment, every thread records what it does
+     (waits, signals, and the lines produced and consumed, one in TR_SAMPLE of them)
+     in a trace ring of its own (see trace.h), and main writes a Chrome trace of them all
+     to the file at the end;
+
+  *) whatever the engine, lines are read into buffers from 'pool' (see linepool.h),
+     and a consumer gives the buffer back once it is done with the line;
+
+  *) a consumer takes the line and its number out of the shared object
+     and releases the lock before it prints anything; it collects its output
+     in an outbuf of its own (see outbuf.h), which is written out in large chunks;
+     the producer prints its line before it takes the lock, and the flag functions
+     trace what they do ("TID 3 set 'false'") only when built with DEBUG, and outside the lock,
+     so that no thread waits for the stdio lock while it holds 'flaglock';
+
+  *) with '-o', the consumers' outbufs hand their records to the ordered sink 'order'
+     instead (see reorder.h), which writes them in the order of the line numbers, holding back
+     at most 'window' ('-W') lines; the flag, '-m' and '-f' hand the lines out in order,
+     so the consumer with the oldest line is never the one waiting for the window to move;
+     work stealing ('-S') does not (a stolen batch overtakes the lines before it), so '-o'
+     and '-S' don't go together;
+
+  *) what a consumer does with a line, besides printing it, is up to
+     the work function picked with '-w' (see work.h);
+
+  *) with '-a placement', the producer (thread 0) and the consumers (threads 1, 2, ...)
+     are pinned to CPUs by a placement policy (see affinity.h), and what the consumers read
+     goes on their node: main sets up the shared object, the queue and the pool on the node
+     of the first consumer, and each deque ('-S') on the node of the consumer that owns it
 */
 
-// shared object
+// shared object, in regions that start on cache lines of their own:
+// what every thread reads for every line must not share a cache line
+// with what the producer and the consumers write to hand a line over,
+// or each handoff would take it away from all the readers
 typedef struct sharedobject {
+  // read-mostly: set up by main before the threads start
   FILE *rfile;  // file to read lines from
+  mpmc_t *queue; // lock-free queue of lines ('-m' only)
+  size_t batch;  // lines dealt to a deque at a time ('-S' only)
+  size_t fbatch;  // most lines per flag handoff ('-b' only)
+  size_t fbytes;  // most bytes the producer batches up ('-b' only)
+  linepool_t pool; // recycled line buffers
+  int ncons;     // number of consumers
+  reorder_t *order;  // ordered sink for the consumers' output ('-o' only)
+  const work_t *work;  // what the consumers do with each line
+  const char *workarg; // and its argument (or NULL)
+  // the handoff: written under 'flaglock', by the producer and a consumer in turn
+  _Alignas(CACHELINE) pthread_mutex_t flaglock;  // mutex for 'flag'
+  bool flag;     // to coordinate between a producer and consumers
   int linenum;  // line number
   char *line;   // next line to have read
-  bool flag;     // to coordinate between a producer and consumers
-  pthread_mutex_t flaglock;  // mutex for 'flag'
-  pthread_cond_t flag_true;  // conditional variable for 'flag == true'
-  pthread_cond_t flag_false;  // conditional variable for 'flag == false'
+  size_t nlines;  // lines in 'lines' ('-b' only)
+  line_t lines[MAXBATCH];  // the batch in the buffer ('-b' only)
+  // where the consumers wait (and the producer signals)
+  _Alignas(CACHELINE) pthread_cond_t flag_true;  // conditional variable for 'flag == true'
+  // where the producer waits (and the consumers signal)
+  _Alignas(CACHELINE) pthread_cond_t flag_false;  // conditional variable for 'flag == false'
+  wsq_t deques;  // a deque of lines per consumer ('-S' only; its hot fields are aligned already)
+  handoff_t ho;  // futex-based flag protocol ('-f' only; ditto)
+  spinwait_t notfull;   // wait for a free cell in 'queue' ('-m' only; ditto)
+  spinwait_t notempty;  // wait for a line in 'queue' ('-m' only; ditto)
 } so_t;
 
+// a push or pop to retry in sw_wait() ('-m')
+typedef struct attempt {
+  so_t *so;
+  line_t *item;  // the line to push or pop
+} attempt_t;
+
 // arguments to consumer threads
 // each thread needs to know it's number (for printing out)
-// plus have access to the shared object
+// plus have access to the shared object;
+// each one on a cache line of its own, since they sit next to each other in 'carg'
 typedef struct targ {
-  long tid;      // thread number
+  _Alignas(CACHELINE) long tid;      // thread number
   so_t *soptr;   // pointer to shared object
 } targ_t;
 
-char *readline( FILE *rfile );
+char *readline( FILE *rfile, linepool_t *pool );
 bool waittilltrue( so_t *so, int tid );
 bool waittilfalse( so_t *so, int tid );
 void *producer( void *arg );
 void *consumer( void *arg );
+// read lines from a file, push them into the lock-free queue
+void *mproducer( void *arg );
+// pop lines from the lock-free queue
+void *mconsumer( void *arg );
+// read lines from a file, deal them out to the consumers' deques
+void *wsproducer( void *arg );
+// take lines from our own deque, or steal them from the others
+void *wsconsumer( void *arg );
+// read lines from a file, hand them over one at a time through the futex handoff
+void *fproducer( void *arg );
+// take lines from the futex handoff
+void *fconsumer( void *arg );
+// read lines from a file, hand them over a batch at a time through the flag
+void *bproducer( void *arg );
+// take batches of lines from the flag protocol
+void *bconsumer( void *arg );
+
+// the time in ns
+static long
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // now
+
+// print how to use the program and quit
+static void
+usage( const char *prog ) {
+  fprintf( stderr, "Usage: %s [-m slots | -S batch | -f | -b batch [-B batchbytes]] [-c consumers] [-o [-W window]] [-w work[:arg]]\n"
+	   "       [-a " AF_POLICIES "] filename\n", prog );
+  fprintf( stderr, "work: " );
+  work_list( stderr );
+  exit( EXIT_FAILURE );
+} // usage
 
 int
 main( int argc, char *argv[] ) {
 
-  // check use
-  if( argc < 2 ){
-    fprintf( stderr, "Usage: %s filename\n", argv[0] );
-    exit( EXIT_FAILURE );
+  size_t slots = 0; // capacity of the lock-free queue; 0 for the flag protocol
+  size_t batch = 0; // lines dealt to a deque at a time; 0 for no work stealing
+  bool futex = false; // use the futex handoff for the flag protocol
+  size_t fbatch = 0; // most lines per flag handoff; 0 for one line at a time
+  size_t fbytes = BATCH_BYTES; // most bytes the producer batches up
+  int ncons = NUM_CONSUMERS; // number of consumers
+  bool ordered = false; // write the consumers' output in the order of the line numbers
+  size_t window = REORDER_WINDOW; // lines the ordered output may hold back
+  const char *workarg = NULL; // argument to the work function
+  const work_t *work = work_lookup( "len", &workarg ); // what the consumers do with a line
+  const char *placement = NULL; // where the threads run (NULL: wherever the kernel likes)
+  int opt;
+  while( (opt = getopt( argc, argv, "m:S:fb:B:c:oW:w:a:" )) != -1 ) {
+    switch( opt ) {
+    case 'm':
+      slots = strtoul( optarg, NULL, 10 );
+      break;
+    case 'S':
+      batch = strtoul( optarg, NULL, 10 );
+      break;
+    case 'f':
+      futex = true;
+      break;
+    case 'b':
+      fbatch = strtoul( optarg, NULL, 10 );
+      break;
+    case 'B':
+      fbytes = strtoul( optarg, NULL, 10 );
+      break;
+    case 'o':
+      ordered = true;
+      break;
+    case 'W':
+      window = strtoul( optarg, NULL, 10 );
+      break;
+    case 'c':
+      ncons = atoi( optarg );
+      break;
+    case 'w':
+      if( !( work = work_lookup( optarg, &workarg ) ) )
+	usage( argv[0] );
+      break;
+    case 'a':
+      placement = optarg;
+      break;
+    default:
+      usage( argv[0] );
+    }
   }
 
+  // check use
+  if( optind >= argc || ( slots > 0 ) + ( batch > 0 ) + futex + ( fbatch > 0 ) > 1 || batch > MAXBATCH
+      || fbatch > MAXBATCH || fbytes == 0 || ncons < 1
+      || window == 0 || ( ordered && batch > 0 ) )
+    usage( argv[0] );
+
+  // check the argument of the work function before any thread needs it
+  work->fini( work->init( workarg ) );
+
+  affinity_t aff; // thread 0 is the producer, thread 1 + i consumer i
+  if( !af_init( &aff, placement ) )
+    usage( argv[0] );
+
+  lat_init( ); // record handoff latencies for pcbench (if asked to)
+  tr_init( );  // trace the threads (if asked to)
+  struct timespec begin, end; // the run, up to the joins (not writing the trace)
+  clock_gettime( CLOCK_MONOTONIC, &begin );
+
   // open a file
-  FILE * rfile = fopen( (char *) argv[1], "r" );
+  FILE * rfile = fopen( argv[optind], "r" );
   if( !rfile ) {
-    printf( "error opening %s\n", argv[0] );
+    printf( "error opening %s\n", argv[optind] );
     exit( EXIT_FAILURE );
   }
 
   int rc = 0; // return code
 
+  af_move( &aff, 1 ); // what follows goes on the consumers' node
+
   // shared object
-  so_t *share = malloc( sizeof(so_t) );
+  so_t *share = aligned_alloc( CACHELINE, sizeof(so_t) ); // its regions want cache lines of their own
+  if( !share )
+    errno_abort( "allocate shared object" );
   // initialize the shared object
   share->rfile = rfile;
+  share->ncons = ncons;
+  share->order = NULL;
+  if( ordered ) {
+    share->order = malloc( sizeof(reorder_t) );
+    if( !share->order )
+      errno_abort( "allocate ordered sink" );
+    ro_init( share->order, stdout, window, 0 );
+  }
   share->line = NULL;
   share->flag = false; // initially, the buffer is empty
+  share->queue = slots > 0 ? mpmc_create( slots ) : NULL;
+  share->batch = batch;
+  share->fbatch = fbatch;
+  share->fbytes = fbytes;
+  share->nlines = 0;
+  share->work = work;
+  share->workarg = workarg;
+  void *(*prodfun)( void * ) = producer;
+  void *(*consfun)( void * ) = consumer;
+  if( slots > 0 ) {
+    // lines in flight: the queue, one per consumer, one being read
+    lp_init( &share->pool, share->queue->mask + 1 + ncons + 1, MAXLINE );
+    sw_init( &share->notfull );
+    sw_init( &share->notempty );
+    prodfun = mproducer;
+    consfun = mconsumer;
+  }
+  else if( batch > 0 ) {
+    wsq_init( &share->deques, ncons, WS_DEPTH * batch );
+    for( int i = 0; i < ncons; ++i ) // each deque goes on its owner's node
+      af_touch( &aff, 1 + i, share->deques.deques[i].slots, share->deques.deques[i].cap * sizeof(line_t) );
+    // lines in flight: the deques, and a batch in the hands of each consumer and the producer
+    lp_init( &share->pool, ( ncons * WS_DEPTH + ncons + 1 ) * batch, MAXLINE );
+    prodfun = wsproducer;
+    consfun = wsconsumer;
+  }
+  else if( fbatch > 0 ) { // lines in flight: a batch in the buffer, and one in the hands of each thread
+    lp_init( &share->pool, ( 1 + ncons + 1 ) * fbatch, MAXLINE );
+    prodfun = bproducer;
+    consfun = bconsumer;
+  }
+  else { // lines in flight: the buffer, one per consumer, one being read
+    lp_init( &share->pool, 1 + ncons + 1, MAXLINE );
+    if( futex ) {
+      ho_init( &share->ho );
+      prodfun = fproducer;
+      consfun = fconsumer;
+    }
+  }
   // initialize mutex; starts off unlocked
   if( (rc = pthread_mutex_init( &share->flaglock, NULL )) != 0 )
     err_abort( rc, "mutex init" );
@@ -85,24 +340,38 @@ main( int argc, char *argv[] ) {
     err_abort( rc, "flag_true init" );
   if( (rc = pthread_cond_init( &share->flag_false, NULL )) != 0 )
     err_abort( rc, "flag_false init" );
+  // the line buffers are untouched so far: they go on the consumers' node as well
+  af_touch( &aff, 1, share->pool.arena, share->pool.nbufs * share->pool.bufsize );
+  af_return( &aff );
 
   pthread_t prod;                 // producer thread
-  pthread_t cons[NUM_CONSUMERS];  // consumer threads
-  targ_t carg[NUM_CONSUMERS];     // arguments to consumer threads
+  pthread_t cons[ncons];  // consumer threads
+  targ_t carg[ncons];     // arguments to consumer threads
+  pthread_attr_t attr;    // where a thread runs
   
   // create producer thread
-  if( (rc = pthread_create( &prod, NULL, producer, (void *) share )) != 0 )
+  if( (rc = pthread_attr_init( &attr )) != 0 )
+    err_abort( rc, "attr init" );
+  af_attr( &aff, 0, &attr );
+  if( (rc = pthread_create( &prod, &attr, prodfun, (void *) share )) != 0 )
     err_abort( rc, "create producer thread" );
+  pthread_attr_destroy( &attr );
 
   // create consumer threads
-  for( int i = 0; i < NUM_CONSUMERS; ++i ) {
+  for( int i = 0; i < ncons; ++i ) {
     carg[i].tid = i;
     carg[i].soptr = share;
-    if( (rc =  pthread_create( &cons[i], NULL, consumer, &carg[i]) ) != 0 )
+    if( (rc = pthread_attr_init( &attr )) != 0 )
+      err_abort( rc, "attr init" );
+    af_attr( &aff, 1 + i, &attr );
+    if( (rc =  pthread_create( &cons[i], &attr, consfun, &carg[i]) ) != 0 )
       err_abort( rc, "create consumer thread" );
+    pthread_attr_destroy( &attr );
   } // for
 
   printf("Producer and consumers created; main continuing\n");
+  printf( "main: " );
+  af_print( &aff, 1 + ncons, stdout );
   
   void *ret = NULL; // return value from threads
 
@@ -110,11 +379,44 @@ main( int argc, char *argv[] ) {
     err_abort( rc, "join producer thread" );
   printf( "main: producer joined with %d lines produced \n", *((int *) ret) );
   
-  for (int i = 0; i < NUM_CONSUMERS; ++i) {
+  int most = 0, total = 0; // the consumer that consumed the most lines, all of them
+  for (int i = 0; i < ncons; ++i) {
     if( (rc = pthread_join( cons[i], &ret )) != 0)
     err_abort( rc, "join consumer thread" );
     printf( "main: consumer %d joined with %d lines consumed \n", i, *((int *) ret) );
+    total += *((int *) ret);
+    if( *((int *) ret) > most )
+      most = *((int *) ret);
+    free( ret );
   } // for
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  printf( "main: %d lines in %.3f s\n", total,
+	  ( end.tv_sec - begin.tv_sec ) + ( end.tv_nsec - begin.tv_nsec ) / 1e9 );
+  // 1.0 is a perfect balance; 'ncons' means one consumer did it all
+  printf( "main: balance %.3f (most lines per consumer / mean)\n",
+	  total ? (double) most * ncons / total : 0.0 );
+  if( batch > 0 ) {
+    unsigned long steals = 0, stolen = 0;
+    for( int i = 0; i < ncons; ++i ) {
+      steals += share->deques.deques[i].steals;
+      stolen += share->deques.deques[i].stolen;
+    }
+    printf( "main: %lu steals took %lu lines\n", steals, stolen );
+    wsq_destroy( &share->deques );
+  }
+  if( share->queue ) {
+    sw_report( &share->notfull, "main: producer" );
+    sw_report( &share->notempty, "main: consumers" );
+  }
+  if( share->order ) {
+    printf( "main: reorder window %zu: %lu waits, at most %zu lines held back\n",
+	    share->order->window, share->order->waits, share->order->maxheld );
+    ro_destroy( share->order );
+    free( share->order );
+  }
+  lat_dump( );
+  ls_dump( stdout );
+  tr_dump( );
 
   // destroy mutex
   if( (rc = pthread_mutex_destroy( &share->flaglock )) != 0)
@@ -124,7 +426,11 @@ main( int argc, char *argv[] ) {
     err_abort( rc, "destroy flag_true" );
   if( (rc = pthread_cond_destroy( &share->flag_false )) != 0)
     err_abort( rc, "destroy flag_false" );
+  if( share->queue )
+    mpmc_destroy( share->queue );
+  lp_destroy( &share->pool );
   free( share );  // destroy shared object
+  af_destroy( &aff );
   pthread_exit(NULL);
 
 } // main
@@ -135,15 +441,17 @@ bool
 waittilltrue( so_t *so, int tid ) {
   // wait until the codition "so->flag == true" is met
   int rc;
-  if( (rc = pthread_mutex_lock( &so->flaglock  )) != 0 ) // lock the object to get access to the flag
+  (void) tid; // DPRINTF() only
+  DPRINTF(( "TID %d waiting till 'true'\n", tid )); // before the lock: stdio has a lock of its own
+  if( (rc = ls_lock( &so->flaglock )) != 0 ) // lock the object to get access to the flag
     err_abort( rc, "lock mutex" );
   while( so->flag != true ) { // check the predicate associated with 'so->flag_true'
-    printf( "TID %d waiting till 'true'\n", tid );
     // realease the lock and wait (done atomically)
-    pthread_cond_wait( &so->flag_true, &so->flaglock ); // return locks the mutex
+    tr_event( TR_WAIT, -1 );
+    ls_cond_wait( &so->flag_true, &so->flaglock ); // return locks the mutex
+    tr_event( TR_WOKE, -1 );
   }
   // we're holding the lock AND so->flag == val
-  printf( "TID %d got 'true'\n", tid );
   return true;
 }
 
@@ -153,38 +461,47 @@ bool
 waittillfalse( so_t *so, int tid ) {
   // wait until the codition "so->flag == false" is met
   int rc;
-  if( (rc = pthread_mutex_lock( &so->flaglock  )) != 0 ) // lock the object to get access to the flag
+  (void) tid; // DPRINTF() only
+  DPRINTF(( "TID %d waiting till 'false'\n", tid )); // before the lock: stdio has a lock of its own
+  if( (rc = ls_lock( &so->flaglock )) != 0 ) // lock the object to get access to the flag
     err_abort( rc, "lock mutex" );
   while( so->flag == true ) { // check the predicate associated with 'so->flag_true'
-    printf( "TID %d waiting till 'false'\n", tid );
     // realease the lock and wait (done atomically)
-    pthread_cond_wait( &so->flag_false, &so->flaglock ); // return locks the mutex
+    tr_event( TR_WAIT, -1 );
+    ls_cond_wait( &so->flag_false, &so->flaglock ); // return locks the mutex
+    tr_event( TR_WOKE, -1 );
   }
   // we're holding the lock AND so->flag == val
-  printf( "TID %d got 'false'\n", tid );
   return true;
 }
 
 int
 releasetrue( so_t *so, int tid ) {
   so->flag = true;
-  printf( "TID %d set 'true'\n", tid );
   pthread_cond_signal( &so->flag_true );
-  return pthread_mutex_unlock( &so->flaglock );
+  tr_event( TR_SIGNAL, -1 );
+  int rc = ls_unlock( &so->flaglock );
+  (void) tid; // DPRINTF() only
+  DPRINTF(( "TID %d set 'true'\n", tid )); // after the lock, like the consumers' output
+  return rc;
 }
 
 int
 releasefalse( so_t *so, int tid ) {
   so->flag = false;
-  printf( "TID %d set 'false'\n", tid );
   pthread_cond_signal( &so->flag_false );
-  return pthread_mutex_unlock( &so->flaglock );
+  tr_event( TR_SIGNAL, -1 );
+  int rc = ls_unlock( &so->flaglock );
+  (void) tid; // DPRINTF() only
+  DPRINTF(( "TID %d set 'false'\n", tid )); // after the lock, like the consumers' output
+  return rc;
 }
 
 int
-release_exit( so_t *so, int tid ) {
+release_exit( so_t *so ) {
   pthread_cond_signal( &so->flag_true );
-  return pthread_mutex_unlock( &so->flaglock );
+  tr_event( TR_SIGNAL, -1 );
+  return ls_unlock( &so->flaglock );
 }
 
 void *
@@ -195,13 +512,18 @@ producer( void *arg ) {
   int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
   int i = 0; // to count lines produced
   char *line; // next line
+  ls_thread( "Prod" );
+  tr_thread( "Prod" );
   printf("Producer starting\n");
-  while ( (line = readline( so->rfile )) ) {
+  while ( (line = readline( so->rfile, &so->pool )) ) {
+    // print the line while it's still ours (a consumer recycles it), and before we take the lock
+    fprintf( stdout, "Prod: [%d] %s", i, line );
     waittillfalse( so, PROD_ID ); // wait until the flag is 'false' (i.e., buffer is empty) and acquire the lock
     // we're holding the lock
+    lat_put( i );
+    tr_line( TR_PRODUCE, i );
     so->linenum = i++;		
     so->line = line;		// put the line into the shared buffer
-    fprintf( stdout, "Prod: [%d] %s", i, line );
     if( (rc = releasetrue( so, PROD_ID )) != 0)  // set flag to 'true', signal 'flag_true', and release the lock
       err_abort( rc, "unlock mutex" );
   }
@@ -223,32 +545,372 @@ consumer( void *arg ) {
   int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
   int i = 0;
   char *line;
+  int linenum;
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  if( so->order )
+    ob_sink( &out, so->order );
+  void *ctx = so->work->init( so->workarg ); // our state for the work function
+  char report[128]; // what the work function found
+  ls_thread( "Cons %ld", tid );
+  tr_thread( "Cons %ld", tid );
   printf("Consumer %ld starting\n",tid);
   while( waittilltrue( so, tid ) && ( line = so->line ) ) { // wait until the flag is 'true' (i.e., buffer is full) and acquire the lock
     // we're holding the lock
-    len = strlen( line );
-    printf( "Consumer %ld: [%d:%d] %s", tid, i++, so->linenum, line );
+    linenum = so->linenum;
+    lat_get( linenum );
+    tr_line( TR_CONSUME, linenum );
     if( (rc = releasefalse( so, tid )) != 0 )	// set flag to 'false', signal 'flag_false', and release the lock
       err_abort( rc, "unlock mutex" );
+    // the line is ours now: do the job without holding the lock
+    so->work->line( ctx, line, strlen( line ) );
+    ob_printf( &out, linenum, "Consumer %ld: [%d:%d] %s", tid, i++, linenum, line );
+    lp_put( &so->pool, line );  // we're done with the line: recycle its buffer
   }
-  printf( "Cons %ld: %d lines\n", tid, i );
+  ob_destroy( &out ); // write out the rest of our output
+  so->work->report( ctx, report, sizeof(report) );
+  so->work->fini( ctx );
+  printf( "Cons %ld: %d lines, %s\n", tid, i, report );
   // release the lock and signal 'flag_true',
   // so that other consumers who are waiting on 'flag_true' may finish
-  release_exit( so, tid );   
+  release_exit( so );
   *ret = i;
   pthread_exit( ret );
 } // consumer
 
+// function executed by the producer thread with '-b'
+void *
+bproducer( void *arg ) {
+  int rc;
+  so_t *so = (so_t *) arg;
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
+  int i = 0; // to count lines produced
+  line_t batch[MAXBATCH]; // lines not yet handed over
+  size_t n = 0, bytes = 0; // lines and bytes in 'batch'
+  size_t target = so->fbatch; // current batch size
+  long start; // when we started filling the batch
+  ls_thread( "Prod" );
+  tr_thread( "Prod" );
+  printf("Producer starting\n");
+  start = now( );
+  while ( (batch[n].line = readline( so->rfile, &so->pool )) ) {
+    batch[n].len = strlen( batch[n].line );
+    batch[n].linenum = i++;
+    fprintf( stdout, "Prod: [%d] %s", batch[n].linenum, batch[n].line );
+    bytes += batch[n++].len;
+    if( n < target && bytes < so->fbytes )
+      continue;
+    // adapt the batch size to the rate at which lines come in: only the time spent
+    // filling the batch counts, not the time spent waiting for the flag
+    if( now( ) - start > BATCH_NSEC )
+      target = target > 1 ? target / 2 : 1;
+    else if( target < so->fbatch )
+      target *= 2;
+    waittillfalse( so, PROD_ID ); // wait until the buffer is empty and acquire the lock
+    // we're holding the lock
+    for( size_t b = 0; b < n; ++b ) {
+      lat_put( batch[b].linenum );
+      tr_line( TR_PRODUCE, batch[b].linenum );
+    }
+    memcpy( so->lines, batch, n * sizeof(line_t) );
+    so->nlines = n;
+    if( (rc = releasetrue( so, PROD_ID )) != 0 ) // set flag to 'true', signal 'flag_true', and release the lock
+      err_abort( rc, "unlock mutex" );
+    n = bytes = 0;
+    start = now( );
+  }
+  waittillfalse( so, PROD_ID );
+  for( size_t b = 0; b < n; ++b ) { // the last (partial) batch, if any
+    lat_put( batch[b].linenum );
+    tr_line( TR_PRODUCE, batch[b].linenum );
+  }
+  memcpy( so->lines, batch, n * sizeof(line_t) );
+  so->nlines = n;
+  if( n > 0 ) { // and after it, the end of the input
+    releasetrue( so, PROD_ID );
+    waittillfalse( so, PROD_ID );
+    so->nlines = 0;
+  }
+  releasetrue( so, PROD_ID ); // allow the consumer loops to quit
+  printf( "Prod: %d lines\n", i );
+  *ret = i;
+  pthread_exit( ret );
+} // bproducer
+
+// function executed by a consumer thread with '-b'
+void *
+bconsumer( void *arg ) {
+  int rc;
+  targ_t *targ = (targ_t *) arg;
+  long tid = targ->tid;    // thread's 'id'
+  so_t *so = targ->soptr;  // shared object
+  int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
+  int i = 0;
+  line_t batch[MAXBATCH];
+  size_t n;
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  if( so->order )
+    ob_sink( &out, so->order );
+  void *ctx = so->work->init( so->workarg ); // our state for the work function
+  char report[128]; // what the work function found
+  ls_thread( "Cons %ld", tid );
+  tr_thread( "Cons %ld", tid );
+  printf("Consumer %ld starting\n", tid);
+  while( waittilltrue( so, tid ) && ( n = so->nlines ) > 0 ) { // wait until the buffer is full and acquire the lock
+    // we're holding the lock: take the whole batch
+    memcpy( batch, so->lines, n * sizeof(line_t) );
+    for( size_t b = 0; b < n; ++b ) {
+      lat_get( batch[b].linenum );
+      tr_line( TR_CONSUME, batch[b].linenum );
+    }
+    if( (rc = releasefalse( so, tid )) != 0 ) // set flag to 'false', signal 'flag_false', and release the lock
+      err_abort( rc, "unlock mutex" );
+    // the lines are ours now: do the job without holding the lock
+    for( size_t b = 0; b < n; ++b ) {
+      line_t *item = &batch[b];
+      so->work->line( ctx, item->line, item->len );
+      ob_printf( &out, item->linenum, "Consumer %ld: [%d:%d] %s", tid, i++, item->linenum, item->line );
+      lp_put( &so->pool, item->line ); // recycle the buffer
+    }
+  }
+  ob_destroy( &out ); // write out the rest of our output
+  so->work->report( ctx, report, sizeof(report) );
+  so->work->fini( ctx );
+  printf( "Cons %ld: %d lines, %s\n", tid, i, report );
+  // release the lock and signal 'flag_true',
+  // so that other consumers who are waiting on 'flag_true' may finish
+  release_exit( so );
+  *ret = i;
+  pthread_exit( ret );
+} // bconsumer
+
+static bool
+trypush( void *arg ) {
+  attempt_t *a = arg;
+  return mpmc_push( a->so->queue, a->item );
+} // trypush
+
+static bool
+trypop( void *arg ) {
+  attempt_t *a = arg;
+  return mpmc_pop( a->so->queue, a->item );
+} // trypop
+
+// function executed by the producer thread with '-m'
+void *
+mproducer( void *arg ) {
+  so_t *so = (so_t *) arg;
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
+  int i = 0; // to count lines produced
+  line_t item; // next line
+  attempt_t push = { so, &item };
+  tr_thread( "Prod" );
+  printf("Producer starting\n");
+  while ( (item.line = readline( so->rfile, &so->pool )) ) {
+    item.len = strlen( item.line );
+    item.linenum = i++;
+    fprintf( stdout, "Prod: [%d] %s", item.linenum, item.line );
+    lat_put( item.linenum );
+    tr_line( TR_PRODUCE, item.linenum );
+    if( !mpmc_push( so->queue, &item ) ) { // the queue is full: wait for the consumers
+      tr_event( TR_WAIT, -1 );
+      sw_wait( &so->notfull, trypush, &push );
+      tr_event( TR_WOKE, -1 );
+    }
+    sw_wake( &so->notempty );
+  }
+  // allow every consumer's loop to quit
+  item.line = NULL;
+  for( int c = 0; c < so->ncons; ++c ) {
+    if( !mpmc_push( so->queue, &item ) )
+      sw_wait( &so->notfull, trypush, &push );
+    sw_wake( &so->notempty );
+  }
+  printf( "Prod: %d lines\n", i );
+  *ret = i;
+  pthread_exit( ret );
+} // mproducer
+
+// function executed by a consumer thread with '-m'
+void *
+mconsumer( void *arg ) {
+  targ_t *targ = (targ_t *) arg;
+  long tid = targ->tid;    // thread's 'id'
+  so_t *so = targ->soptr;  // shared object
+  int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
+  int i = 0;
+  line_t item;
+  attempt_t pop = { so, &item };
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  if( so->order )
+    ob_sink( &out, so->order );
+  void *ctx = so->work->init( so->workarg ); // our state for the work function
+  char report[128]; // what the work function found
+  tr_thread( "Cons %ld", tid );
+  printf("Consumer %ld starting\n", tid);
+  for( ; ; ) {
+    if( !mpmc_pop( so->queue, &item ) ) { // the queue is empty: wait for the producer
+      tr_event( TR_WAIT, -1 );
+      sw_wait( &so->notempty, trypop, &pop );
+      tr_event( TR_WOKE, -1 );
+    }
+    sw_wake( &so->notfull );
+    if( !item.line ) // no more lines
+      break;
+    lat_get( item.linenum );
+    tr_line( TR_CONSUME, item.linenum );
+    so->work->line( ctx, item.line, item.len );
+    ob_printf( &out, item.linenum, "Consumer %ld: [%d:%d] %s", tid, i++, item.linenum, item.line );
+    lp_put( &so->pool, item.line ); // recycle the buffer
+  }
+  ob_destroy( &out ); // write out the rest of our output
+  so->work->report( ctx, report, sizeof(report) );
+  so->work->fini( ctx );
+  printf( "Cons %ld: %d lines, %s\n", tid, i, report );
+  *ret = i;
+  pthread_exit( ret );
+} // mconsumer
+
+// function executed by the producer thread with '-S'
+void *
+wsproducer( void *arg ) {
+  so_t *so = (so_t *) arg;
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
+  int i = 0; // to count lines produced
+  line_t batch[MAXBATCH]; // lines not yet dealt out
+  size_t n = 0; // lines in 'batch'
+  int c = 0; // deque to deal the next batch to
+  tr_thread( "Prod" );
+  printf("Producer starting\n");
+  while ( (batch[n].line = readline( so->rfile, &so->pool )) ) {
+    batch[n].len = strlen( batch[n].line );
+    batch[n].linenum = i++;
+    fprintf( stdout, "Prod: [%d] %s", batch[n].linenum, batch[n].line );
+    if( ++n == so->batch ) {
+      for( size_t b = 0; b < n; ++b ) {
+	lat_put( batch[b].linenum );
+	tr_line( TR_PRODUCE, batch[b].linenum );
+      }
+      c = ( wsq_put( &so->deques, c, batch, n ) + 1 ) % so->ncons;
+      n = 0;
+    }
+  }
+  if( n > 0 ) { // the last (partial) batch
+    for( size_t b = 0; b < n; ++b ) {
+      lat_put( batch[b].linenum );
+      tr_line( TR_PRODUCE, batch[b].linenum );
+    }
+    wsq_put( &so->deques, c, batch, n );
+  }
+  // allow the consumer loops to quit once the deques are empty
+  wsq_close( &so->deques );
+  printf( "Prod: %d lines\n", i );
+  *ret = i;
+  pthread_exit( ret );
+} // wsproducer
+
+// function executed by a consumer thread with '-S'
+void *
+wsconsumer( void *arg ) {
+  targ_t *targ = (targ_t *) arg;
+  long tid = targ->tid;    // thread's 'id'
+  so_t *so = targ->soptr;  // shared object
+  int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
+  int i = 0;
+  line_t batch[MAXBATCH];
+  size_t n;
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  if( so->order )
+    ob_sink( &out, so->order );
+  void *ctx = so->work->init( so->workarg ); // our state for the work function
+  char report[128]; // what the work function found
+  tr_thread( "Cons %ld", tid );
+  printf("Consumer %ld starting\n", tid);
+  while( (n = wsq_get( &so->deques, tid, batch, so->batch )) > 0 ) {
+    for( size_t b = 0; b < n; ++b ) {
+      line_t *item = &batch[b];
+      lat_get( item->linenum );
+      tr_line( TR_CONSUME, item->linenum );
+      so->work->line( ctx, item->line, item->len );
+      ob_printf( &out, item->linenum, "Consumer %ld: [%d:%d] %s", tid, i++, item->linenum, item->line );
+      lp_put( &so->pool, item->line ); // recycle the buffer
+    }
+  }
+  ob_destroy( &out ); // write out the rest of our output
+  so->work->report( ctx, report, sizeof(report) );
+  so->work->fini( ctx );
+  printf( "Cons %ld: %d lines, %lu steals, %s\n", tid, i, so->deques.deques[tid].steals, report );
+  *ret = i;
+  pthread_exit( ret );
+} // wsconsumer
+
+// function executed by the producer thread with '-f'
+void *
+fproducer( void *arg ) {
+  so_t *so = (so_t *) arg;
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
+  int i = 0; // to count lines produced
+  line_t item; // next line
+  tr_thread( "Prod" );
+  printf("Producer starting\n");
+  while ( (item.line = readline( so->rfile, &so->pool )) ) {
+    item.len = strlen( item.line );
+    item.linenum = i++;
+    fprintf( stdout, "Prod: [%d] %s", item.linenum, item.line );
+    lat_put( item.linenum );
+    tr_line( TR_PRODUCE, item.linenum );
+    ho_put( &so->ho, &item ); // wait until the slot is empty and fill it
+  }
+  // allow the consumer loops to quit once the last line is taken
+  ho_close( &so->ho );
+  printf( "Prod: %d lines\n", i );
+  *ret = i;
+  pthread_exit( ret );
+} // fproducer
+
+// function executed by a consumer thread with '-f'
+void *
+fconsumer( void *arg ) {
+  targ_t *targ = (targ_t *) arg;
+  long tid = targ->tid;    // thread's 'id'
+  so_t *so = targ->soptr;  // shared object
+  int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
+  int i = 0;
+  line_t item;
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  if( so->order )
+    ob_sink( &out, so->order );
+  void *ctx = so->work->init( so->workarg ); // our state for the work function
+  char report[128]; // what the work function found
+  tr_thread( "Cons %ld", tid );
+  printf("Consumer %ld starting\n", tid);
+  while( ho_get( &so->ho, &item ) ) { // wait until the slot is full and empty it
+    // the line is ours now
+    lat_get( item.linenum );
+    tr_line( TR_CONSUME, item.linenum );
+    so->work->line( ctx, item.line, item.len );
+    ob_printf( &out, item.linenum, "Consumer %ld: [%d:%d] %s", tid, i++, item.linenum, item.line );
+    lp_put( &so->pool, item.line ); // recycle the buffer
+  }
+  ob_destroy( &out ); // write out the rest of our output
+  so->work->report( ctx, report, sizeof(report) );
+  so->work->fini( ctx );
+  printf( "Cons %ld: %d lines, %s\n", tid, i, report );
+  *ret = i;
+  pthread_exit( ret );
+} // fconsumer
+
 char *
-readline( FILE *rfile ) {
-  /* Read a line from a file and return a new line string object */
-  char buf[MAXLINE];
-  int len;
-  char *result = NULL;
-  char *line = fgets( buf, MAXLINE, rfile );
-  if( line ) {
-    len = strnlen( buf, MAXLINE );
-    result = strncpy( malloc( len+1 ), buf , len+1 );
-  }
-  return result;
+readline( FILE *rfile, linepool_t *pool ) {
+  /* Read a line from a file into a buffer from the pool */
+  char *buf = lp_get( pool );
+  if( !fgets( buf, MAXLINE, rfile ) ) {
+    lp_put( pool, buf ); // nothing read: the buffer goes back
+    return NULL;
+  }
+  return buf;
 }
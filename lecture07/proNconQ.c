@@ -0,0 +1,810 @@
+// a producer-consumer protocol implemented with
+// a bounded ring buffer of line slots (see ring.h)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "ring.h"
+#include "linepool.h"
+#include "linescan.h"
+#include "outbuf.h"
+#include "reorder.h"
+#include "reader.h"
+#include "work.h"
+#include "tpool.h"
+
+#define MAXLINE 1000
+#define NUM_SLOTS 64   // default capacity of the ring
+#define READSIZE ( 1 << 20 )  // bytes read from the file at a time
+#define READ_DEPTH 4  // reads in flight with '--uring' or '--readahead'
+#define NUM_SPANS 256  // lines split off the input at a time
+#define NUM_BATCH 32   // default number of lines moved per lock acquisition
+#define MAXBATCH 256   // most lines moved per lock acquisition
+#define BATCH_BYTES ( 64 << 10 )  // default number of bytes a producer batches up
+#define BATCH_NSEC 1000000  // most time (ns) a producer should spend filling a batch
+#define OUTBUF ( 1 << 16 )  // bytes of output a thread buffers before it writes them
+#define REORDER_WINDOW 4096  // default number of lines the ordered output may hold back ('-o')
+#define SCALE_NSEC 5000000   // how often main looks at the ring to grow the consumer pool ('-g')
+#define IDLE_NSEC 50000000   // how long a consumer waits for a line before it retires ('-g')
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) unlike proNcon2CV.c, where the producer and the consumers hand a single line
+     over through 'so->line', here they share a ring of 'slots' lines;
+
+  *) the producer only waits when the ring is full, and a consumer only waits
+     when the ring is empty, so the producer can run ahead in bursts
+     while the consumers drain the ring in batches;
+
+  *) with '-H high' and '-L low', "full" is the high watermark: a producer that finds
+     'high' lines in the ring sleeps until the consumers have taken it down to 'low'
+     (see ring_marks()), so it wakes up once per burst rather than once per free slot;
+     the wakeups of both sides are counted and printed at the end;
+
+  *) each line carries its own line number, since several lines
+     are in the ring at the same time;
+
+  *) lines are read into buffers from 'pool' (see linepool.h), and a consumer gives
+     the buffer back once it is done with the line, so memory use is bounded
+     by the capacity of the ring rather than by the size of the file;
+
+  *) with '--mmap', the file is mapped into memory once, and the producer
+     hands the consumers (pointer, length) views into the mapping instead:
+     nothing is copied, and there are no buffers to give back;
+
+  *) either way, the producer splits the input into lines with linescan() (see linescan.h),
+     which finds the '\n's of a whole buffer at a time; without '--mmap', the file
+     is read READSIZE bytes at a time, and each line is then copied into a buffer from 'pool';
+     the producer splits the reader's buffers in place (see rd_next()), and only a line
+     that straddles two of them is put together in 'carry' first;
+
+  *) the file is read through 'reader' (see reader.h); with '--uring', READ_DEPTH reads
+     of READSIZE bytes are kept in flight with io_uring, so the disk reads ahead while
+     the producer splits what it has (where there is no io_uring, it falls back to pread(2));
+     with '--readahead', a reader thread of its own fills READ_DEPTH buffers with read(2)
+     and hands them to the producer through a free list, so reading, splitting and
+     consuming become three stages that run at the same time;
+
+  *) main() reports the throughput of each stage over the time it was busy: the reader's
+     over its time in read(2)/pread(2), the producers' and the consumers' over their run
+     less the time they spent waiting for input ('rd_read()', 'ring_get_batch()') and
+     for room ('ring_put_batch()'): the stage with the lowest busy rate is the bottleneck;
+
+  *) with '-p nprod', the mapped file is cut into 'nprod' byte ranges, one per producer,
+     and each range is moved forward to start right after a '\n';
+     to keep the line numbers global, each producer first counts the lines in its range,
+     the producers wait for each other at the barrier 'counted',
+     and then each one numbers its lines from the sum of the counts of the ranges before it;
+
+  *) lines are moved in batches, to take the lock once per batch rather than once per line:
+     a producer collects up to 'batch' lines (or 'batchbytes' bytes) before it puts them,
+     and a consumer takes up to 'batch' lines at a time (see ring_get_batch());
+     the producer adapts its batch size to the rate at which lines come in: it halves it
+     whenever filling a batch took longer than BATCH_NSEC (few lines: don't keep
+     the consumers waiting for a batch to fill up), and doubles it (up to 'batch') otherwise;
+     the time it waits for room in the ring doesn't count, so slow consumers don't shrink it
+
+  *) threads do not printf() their output line by line, but collect it
+     in an outbuf of their own, which is written out in large chunks (see outbuf.h);
+     with '-o' and a single producer, the consumers hand their records to the ordered
+     sink 'order' instead (see reorder.h), which writes them in the order of the line numbers
+     as they come, holding back at most 'window' ('-W') lines; that is safe since the ring
+     hands the lines out in order and every consumer emits its batch in order;
+     with '-o' and several producers, the lines enter the ring out of order, and a window
+     could wait forever for a line that is stuck behind it: there, the consumers'
+     outbufs 'outs' keep their output, and main() merges it in the order of the line numbers at the end;
+
+  *) what a consumer does with a line is up to the work function picked with '-w'
+     (see work.h), which gets a context of its own in every consumer;
+     with '-q', nobody prints the lines, so only the work is left to measure;
+
+  *) there are '-c' consumers (by default, one per online CPU); with '-g fewest', the pool
+     starts out with 'fewest' of them and grows and shrinks as it goes: while the producers run,
+     main looks at the ring every SCALE_NSEC, and starts another consumer whenever
+     half of 'high' lines or more are waiting in it; a consumer that waited IDLE_NSEC
+     without getting a line retires, unless that would leave fewer than 'fewest';
+     'poollock' guards 'active' and the state of the consumers' slots, so a slot whose
+     consumer retired can be waited for and given to a new one;
+     the consumers of a slot share its outbuf, one after the other;
+
+  *) the consumers are tasks of a pool of 'maxcons' worker threads (see tpool.h), created
+     once up front: starting a consumer submits a task rather than creating a thread,
+     and the worker of a consumer that retired goes back to sleep on the pool's queue
+*/
+
+// shared object, in regions that start on cache lines of their own,
+// so that what one side writes all the time doesn't take away the cache lines
+// that the other side (or everybody) reads all the time
+typedef struct sharedobject {
+  // read-mostly: set up by main before the threads start
+  FILE *rfile;  // file to read lines from
+  linepool_t pool;  // recycled line buffers
+  char *map;       // the mapped file ('--mmap' only)
+  size_t mapsize;  // its size
+  size_t batch;       // most lines moved per lock acquisition
+  size_t batchbytes;  // most bytes a producer batches up
+  bool ordered;     // write the consumers' output in the order of the line numbers
+  int nprod;       // number of producers
+  int *counts;     // number of lines in each producer's range ('-p' only)
+  const work_t *work;  // what the consumers do with each line
+  const char *workarg; // and its argument (or NULL)
+  bool quiet;          // don't print the lines
+  int mincons;     // fewest consumers to keep running
+  int maxcons;     // most consumers to run
+  outbuf_t *outs;  // the consumers' output, one outbuf per slot (on cache lines of their own, see outbuf.h)
+  // the producer's: written by every rd_read()
+  _Alignas(CACHELINE) reader_t reader;  // reads the file ahead ('--uring', '--readahead') or not
+  // shared by both sides, under locks of their own
+  _Alignas(CACHELINE) ring_t ring;  // lines read but not yet consumed
+  _Alignas(CACHELINE) reorder_t order;  // ordered sink ('-o' with a single producer)
+  _Alignas(CACHELINE) pthread_barrier_t counted;  // all producers have counted their lines ('-p' only)
+  atomic_int producing;  // producers still running
+  // the consumer pool
+  _Alignas(CACHELINE) pthread_mutex_t poollock;  // mutex for 'active' and the slots' 'state'
+  int active;              // consumers running
+  unsigned long started;   // consumers started
+  unsigned long retired;   // consumers that retired before the end
+} so_t;
+
+// the producer's view of the input: a buffer split into lines by linescan()
+typedef struct input {
+  char *buf;       // the mapped file, a buffer lent by the reader, or 'carry'
+  size_t size;     // bytes in 'buf'
+  size_t pos;      // first byte of 'buf' not yet split into lines
+  bool eof;        // 'buf' holds all that is left of the file
+  char *base;      // the lines in 'spans' are relative to 'base'
+  span_t spans[NUM_SPANS];  // lines split off but not yet handed on
+  size_t nspans;   // number of lines in 'spans'
+  size_t next;     // next line in 'spans' to hand on
+  char *carry;     // READSIZE bytes: a line that starts in one lent buffer and ends in the next
+  char *chunk;     // the buffer the reader lent us (NULL: none)
+  size_t chunklen; // bytes in it
+  size_t resume;   // where to go on in 'chunk' once the line in 'carry' is handed on
+  long readns;     // time spent waiting in rd_next()
+} in_t;
+
+// arguments to producer threads
+// each producer splits the bytes [begin, end) of the input;
+// each one on a cache line of its own, since they sit next to each other in 'parg'
+typedef struct parg {
+  _Alignas(CACHELINE) long pid;      // producer number
+  so_t *soptr;   // pointer to shared object
+  size_t begin;  // first byte of the range
+  size_t end;    // first byte past the range
+  long runns;    // time from start to finish
+  long waitns;   // of that, time spent waiting for input or for room in the ring
+} parg_t;
+
+// where the consumer of a slot is
+enum cstate {
+  CS_FREE,     // never started, or waited for
+  CS_RUNNING,  // running
+  CS_RETIRED,  // retired: to be waited for
+};
+
+// arguments to consumer threads
+// each thread needs to know it's number (for printing out)
+// plus have access to the shared object;
+// each one on a cache line of its own, since they sit next to each other in 'carg'
+typedef struct targ {
+  _Alignas(CACHELINE) long tid;      // thread number (its slot)
+  so_t *soptr;   // pointer to shared object
+  enum cstate state;  // where the slot's consumer is (under 'poollock')
+  long runns;    // time from start to finish (of all of the slot's consumers)
+  long waitns;   // of that, time spent waiting for lines
+} targ_t;
+
+// the time in ns
+static long
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // now
+
+// lines per second over 'ns' nanoseconds
+static double
+rate( unsigned long lines, long ns ) {
+  return ns > 0 ? lines * 1e9 / ns : 0.0;
+} // rate
+
+// find the next line of the input and store it in 'item'
+// return false if no lines left
+bool nextline( so_t *so, in_t *in, line_t *item );
+// read lines from a file, put them into the ring
+void *producer( void *arg );
+// take lines out of the ring
+void *consumer( void *arg );
+// start a consumer in a free slot if there are fewer than 'maxcons'; return false if not
+static bool grow( so_t *so, tpool_t *tp, tp_future_t *cons, targ_t *carg );
+// wait for the consumer in slot 'i' to finish
+static void join( tpool_t *tp, tp_future_t *cons, int i );
+
+// print how to use the program and quit
+static void
+usage( const char *prog ) {
+  fprintf( stderr, "Usage: %s [-s slots] [-H high] [-L low] [-b batch] [-B batchbytes] [--mmap | --uring | --readahead] [-p producers]\n"
+	   "       [-c consumers [-g fewest]] [-o [-W window]]"
+	   " [-w work[:arg]] [-q] filename\n", prog );
+  fprintf( stderr, "work: " );
+  work_list( stderr );
+  exit( EXIT_FAILURE );
+} // usage
+
+int
+main( int argc, char *argv[] ) {
+
+  size_t slots = NUM_SLOTS; // capacity of the ring
+  size_t high = 0, low = 0; // watermarks of the ring (0: the defaults)
+  bool usemmap = false;      // map the file instead of reading it
+  enum rd_mode mode = RD_PREAD; // how the file is read
+  int depth = 0;             // reads in flight (0: read one buffer at a time)
+  int nprod = 1;             // number of producers
+  size_t batch = NUM_BATCH;  // most lines moved per lock acquisition
+  size_t batchbytes = BATCH_BYTES; // most bytes a producer batches up
+  bool ordered = false;      // write the output in the order of the line numbers
+  size_t window = REORDER_WINDOW; // lines the ordered output may hold back
+  const char *workarg = NULL; // argument to the work function
+  const work_t *work = work_lookup( "len", &workarg ); // what the consumers do with a line
+  bool quiet = false;        // don't print the lines
+  long online = sysconf( _SC_NPROCESSORS_ONLN );
+  int maxcons = online > 0 ? (int) online : 1; // most consumers
+  int mincons = 0;           // fewest consumers (0: a fixed pool of 'maxcons')
+  static struct option longopts[] = {
+    { "mmap", no_argument, NULL, 'M' },
+    { "uring", no_argument, NULL, 'U' },
+    { "readahead", no_argument, NULL, 'R' },
+    { NULL, 0, NULL, 0 }
+  };
+  int opt;
+  while( (opt = getopt_long( argc, argv, "s:H:L:p:b:B:c:g:oW:w:q", longopts, NULL )) != -1 ) {
+    switch( opt ) {
+    case 's':
+      slots = strtoul( optarg, NULL, 10 );
+      break;
+    case 'H':
+      high = strtoul( optarg, NULL, 10 );
+      break;
+    case 'L':
+      low = strtoul( optarg, NULL, 10 );
+      break;
+    case 'p':
+      nprod = atoi( optarg );
+      usemmap = true; // the producers split the mapping between them
+      break;
+    case 'b':
+      batch = strtoul( optarg, NULL, 10 );
+      break;
+    case 'B':
+      batchbytes = strtoul( optarg, NULL, 10 );
+      break;
+    case 'c':
+      maxcons = atoi( optarg );
+      break;
+    case 'g':
+      mincons = atoi( optarg );
+      break;
+    case 'M':
+      usemmap = true;
+      break;
+    case 'U':
+      mode = RD_URING;
+      depth = READ_DEPTH;
+      break;
+    case 'R':
+      mode = RD_THREAD;
+      depth = READ_DEPTH;
+      break;
+    case 'o':
+      ordered = true;
+      break;
+    case 'W':
+      window = strtoul( optarg, NULL, 10 );
+      break;
+    case 'w':
+      if( !( work = work_lookup( optarg, &workarg ) ) )
+	usage( argv[0] );
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage( argv[0] );
+    }
+  }
+
+  // check use
+  if( optind >= argc || slots == 0 || high > slots || ( high > 0 && low >= high ) || nprod < 1 || batch < 1 || batch > MAXBATCH || window == 0
+      || maxcons < 1 || mincons < 0 || mincons > maxcons )
+    usage( argv[0] );
+  bool dynamic = mincons > 0; // the pool grows and shrinks
+  if( !dynamic )
+    mincons = maxcons;
+
+  // check the argument of the work function before any thread needs it
+  work->fini( work->init( workarg ) );
+
+  // open a file
+  FILE * rfile = fopen( argv[optind], "r" );
+  if( !rfile ) {
+    fprintf( stderr, "error opening %s\n", argv[optind] );
+    exit( EXIT_FAILURE );
+  }
+
+  int rc = 0; // return code
+
+  // shared object
+  so_t *share = aligned_alloc( CACHELINE, sizeof(so_t) ); // its regions want cache lines of their own
+  if( !share )
+    errno_abort( "allocate shared object" );
+  // initialize the shared object
+  share->rfile = rfile;
+  long start = now( ); // the reader may start reading right away
+  rd_init( &share->reader, fileno( rfile ), READSIZE, usemmap ? RD_PREAD : mode, usemmap ? 0 : depth );
+  ring_init( &share->ring, slots ); // initially, the ring is empty
+  if( high > 0 )
+    ring_marks( &share->ring, high, low );
+  share->batch = batch;
+  share->batchbytes = batchbytes;
+  share->ordered = ordered;
+  share->work = work;
+  share->workarg = workarg;
+  share->quiet = quiet;
+  share->mincons = mincons;
+  share->maxcons = maxcons;
+  bool merge = ordered && nprod > 1; // keep the output and merge it at the end
+  if( ordered && !merge )
+    ro_init( &share->order, stdout, window, 0 );
+  if( !( share->outs = aligned_alloc( CACHELINE, maxcons * sizeof(outbuf_t) ) ) )
+    errno_abort( "allocate outbufs" );
+  for( int i = 0; i < maxcons; ++i ) {
+    ob_init( &share->outs[i], stdout, OUTBUF, merge );
+    if( ordered && !merge )
+      ob_sink( &share->outs[i], &share->order );
+  }
+  // lines in flight: a full ring, and a batch in the hands of each consumer and each producer
+  lp_init( &share->pool, slots + ( maxcons + nprod ) * batch, MAXLINE );
+  share->map = NULL;
+  share->mapsize = 0;
+  if( usemmap ) {
+    struct stat st;
+    if( fstat( fileno( rfile ), &st ) != 0 )
+      errno_abort( "stat input file" );
+    share->mapsize = st.st_size;
+    if( share->mapsize > 0 ) {
+      share->map = mmap( NULL, share->mapsize, PROT_READ, MAP_PRIVATE, fileno( rfile ), 0 );
+      if( share->map == MAP_FAILED )
+	errno_abort( "mmap input file" );
+      // we'll read the file front to back, once, starting now
+      // (advice values are not flags: each needs a call of its own)
+      if( madvise( share->map, share->mapsize, MADV_SEQUENTIAL ) != 0 )
+	errno_abort( "madvise sequential" );
+      if( madvise( share->map, share->mapsize, MADV_WILLNEED ) != 0 )
+	errno_abort( "madvise willneed" );
+    }
+    else
+      share->map = ""; // an empty file has no lines
+  }
+
+  pthread_t prod[nprod];          // producer threads
+  parg_t parg[nprod];             // arguments to producer threads
+  tpool_t tp;                     // the workers that run the consumers
+  tp_future_t *cons = malloc( maxcons * sizeof(tp_future_t) );  // consumer tasks
+  targ_t *carg = aligned_alloc( CACHELINE, maxcons * sizeof(targ_t) ); // arguments to consumer threads
+  if( !cons || !carg )
+    errno_abort( "allocate consumer slots" );
+
+  // cut the input into ranges that start right after a '\n'
+  for( int p = 0; p < nprod; ++p ) {
+    size_t begin = share->mapsize / nprod * p;
+    if( p > 0 && begin > parg[p-1].begin && share->map[begin-1] != '\n' ) {
+      char *nl = memchr( share->map + begin, '\n', share->mapsize - begin );
+      begin = nl ? (size_t) ( nl - share->map ) + 1 : share->mapsize;
+    }
+    if( p > 0 && begin < parg[p-1].begin ) // the previous range took it all
+      begin = parg[p-1].begin;
+    parg[p].pid = p;
+    parg[p].soptr = share;
+    parg[p].begin = begin;
+    if( p > 0 )
+      parg[p-1].end = begin;
+  } // for
+  parg[nprod-1].end = share->mapsize;
+  share->nprod = nprod;
+  share->counts = malloc( nprod * sizeof(int) );
+  if( (rc = pthread_barrier_init( &share->counted, NULL, nprod )) != 0 )
+    err_abort( rc, "barrier init" );
+  atomic_init( &share->producing, nprod );
+  if( (rc = pthread_mutex_init( &share->poollock, NULL )) != 0 )
+    err_abort( rc, "mutex init" );
+  share->active = 0;
+  share->started = share->retired = 0;
+
+  linescan_select( NULL ); // pick the fastest line splitter once, before any thread uses it
+
+  // create producer threads
+  for( int p = 0; p < nprod; ++p )
+    if( (rc = pthread_create( &prod[p], NULL, producer, &parg[p] )) != 0 )
+      err_abort( rc, "create producer thread" );
+
+  // start consumers: all of them, or the fewest we keep
+  tp_init( &tp, maxcons, NULL );
+  for( int i = 0; i < maxcons; ++i ) {
+    carg[i].tid = i;
+    carg[i].soptr = share;
+    carg[i].state = CS_FREE;
+    carg[i].runns = carg[i].waitns = 0;
+  } // for
+  for( int i = 0; i < mincons; ++i )
+    grow( share, &tp, cons, carg );
+
+  printf( "Producers and consumers created (%zu slots, watermarks %zu/%zu, %d to %d consumers); main continuing\n",
+	  slots, share->ring.high, share->ring.low, mincons, maxcons );
+
+  // while the producers run, add a consumer whenever the lines pile up in the ring
+  if( dynamic ) {
+    struct timespec tick = { 0, SCALE_NSEC };
+    while( atomic_load( &share->producing ) > 0 ) {
+      nanosleep( &tick, NULL );
+      if( ring_count( &share->ring ) >= share->ring.high / 2 )
+	grow( share, &tp, cons, carg );
+    }
+  }
+
+  void *ret = NULL; // return value from threads
+
+  for( int p = 0; p < nprod; ++p ) {
+    if( (rc = pthread_join( prod[p], &ret )) != 0)
+      err_abort( rc, "join producer thread" );
+    printf( "main: producer %d joined with %d lines produced \n", p, *((int *) ret) );
+    free( ret );
+  } // for
+  // allow the consumer loops to quit once the ring is drained
+  ring_close( &share->ring );
+
+  for( int i = 0; i < maxcons; ++i ) {
+    if( (rc = pthread_mutex_lock( &share->poollock )) != 0 )
+      err_abort( rc, "lock mutex" );
+    bool started = carg[i].state != CS_FREE; // running, or retired and not waited for yet
+    if( (rc = pthread_mutex_unlock( &share->poollock )) != 0 )
+      err_abort( rc, "unlock mutex" );
+    if( started )
+      join( &tp, cons, i );
+  } // for
+  tp_destroy( &tp );
+  if( dynamic )
+    printf( "main: %lu consumers started, %lu retired while the lines came in\n",
+	    share->started, share->retired );
+
+  if( merge )
+    ob_merge( share->outs, maxcons, stdout );
+  else if( ordered ) {
+    printf( "main: reorder window %zu: %lu waits, at most %zu lines held back\n",
+	    share->order.window, share->order.waits, share->order.maxheld );
+    ro_destroy( &share->order );
+  }
+  for( int i = 0; i < maxcons; ++i )
+    ob_destroy( &share->outs[i] );
+  free( share->outs );
+  printf( "main: %lu lock acquisitions for %lu lines (%.3f per line)\n",
+	  share->ring.locks, share->ring.lines,
+	  share->ring.lines ? (double) share->ring.locks / share->ring.lines : 0.0 );
+  printf( "main: %lu producer wakeups, %lu consumer wakeups\n",
+	  share->ring.pwakeups, share->ring.cwakeups );
+
+  if( (rc = pthread_barrier_destroy( &share->counted )) != 0 )
+    err_abort( rc, "destroy barrier" );
+  free( share->counts );
+  rd_destroy( &share->reader ); // the reader thread is done with its statistics
+  long elapsed = now( ) - start;
+  if( !usemmap ) {
+    reader_t *rd = &share->reader;
+    printf( "main: %lu reads with %s, %lu stalls waiting for the disk\n",
+	    rd->reads, rd_kind( rd ), rd->stalls );
+    if( rd->mode == RD_URING ) // the kernel reads on its own time
+      printf( "main: reader: %.1f MB read ahead by the kernel", rd->bytes / 1e6 );
+    else
+      printf( "main: reader: %.1f MB in %.3f s busy (%.0f%% of the run), %.1f MB/s",
+	      rd->bytes / 1e6, rd->readns / 1e9, elapsed > 0 ? 100.0 * rd->readns / elapsed : 0.0,
+	      rd->readns > 0 ? rd->bytes * 1e3 / rd->readns : 0.0 );
+    if( rd->mode == RD_THREAD ) // who waited for whom
+      printf( ", waited %lu times for a free buffer", rd->empty.cwakeups );
+    printf( "\n" );
+  }
+  unsigned long lines = share->ring.lines;
+  long busyns = 0;
+  for( int p = 0; p < nprod; ++p )
+    busyns += parg[p].runns - parg[p].waitns;
+  printf( "main: producers: %lu lines, %.3f s busy, %.0f lines/s busy\n",
+	  lines, busyns / 1e9, rate( lines, busyns ) );
+  busyns = 0;
+  for( int i = 0; i < maxcons; ++i )
+    busyns += carg[i].runns - carg[i].waitns;
+  printf( "main: consumers: %lu lines, %.3f s busy, %.0f lines/s busy\n",
+	  lines, busyns / 1e9, rate( lines, busyns ) );
+  printf( "main: %lu lines in %.3f s, %.0f lines/s\n", lines, elapsed / 1e9, rate( lines, elapsed ) );
+  ring_destroy( &share->ring );
+  lp_destroy( &share->pool );
+  if( (rc = pthread_mutex_destroy( &share->poollock )) != 0 )
+    err_abort( rc, "destroy mutex" );
+  free( cons );
+  free( carg );
+  if( share->mapsize > 0 && munmap( share->map, share->mapsize ) != 0 )
+    errno_abort( "munmap input file" );
+  fclose( rfile );
+  free( share );  // destroy shared object
+  pthread_exit(NULL);
+
+} // main
+
+void *
+producer( void *arg ) {
+  parg_t *parg = (parg_t *) arg;
+  long pid = parg->pid;    // producer's 'id'
+  so_t *so = parg->soptr;  // shared object
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
+  int i = 0; // to count lines produced
+  int base = 0; // number of the first line in our range
+  line_t item; // next line
+  line_t batch[MAXBATCH]; // lines not yet put into the ring
+  size_t n = 0, bytes = 0; // lines and bytes in 'batch'
+  size_t target = so->batch; // current batch size
+  long start; // when we started filling the batch
+  outbuf_t out; // our output
+  ob_init( &out, stdout, OUTBUF, false );
+  in_t *in = malloc( sizeof(in_t) ); // the input, split into lines
+  in->pos = in->nspans = in->next = 0;
+  in->readns = 0;
+  long begin = now( ), waitns = 0; // when we started, and how long we've waited
+  in->carry = in->chunk = NULL;
+  in->chunklen = in->resume = 0;
+  if( so->map ) { // our range of the file is in memory already
+    in->buf = so->map + parg->begin;
+    in->size = parg->end - parg->begin;
+    in->eof = true;
+  }
+  else { // the reader lends us the file buffer by buffer
+    if( !( in->buf = in->carry = malloc( READSIZE ) ) )
+      errno_abort( "allocate carry buffer" );
+    in->size = 0;
+    in->eof = false;
+  }
+  printf("Producer %ld starting\n", pid);
+  if( so->nprod > 1 ) { // number our lines after the lines of the ranges before ours
+    int rc;
+    while( nextline( so, in, &item ) ) // a view into the mapping: nothing to give back
+      ++i;
+    so->counts[pid] = i;
+    rc = pthread_barrier_wait( &so->counted ); // wait for the other producers to count theirs
+    if( rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD )
+      err_abort( rc, "barrier wait" );
+    for( int p = 0; p < pid; ++p )
+      base += so->counts[p];
+    in->pos = in->nspans = in->next = i = 0; // start over
+  }
+  start = now( );
+  while( nextline( so, in, &item ) ) {
+    item.linenum = base + i++;
+    if( !so->quiet )
+      ob_printf( &out, item.linenum, "Prod: [%d] %.*s", item.linenum, (int) item.len, item.line );
+    batch[n++] = item;
+    bytes += item.len;
+    if( n >= target || bytes >= so->batchbytes ) {
+      long put = now( );
+      // adapt the batch size to the rate at which lines come in: only the time spent
+      // filling the batch counts, not the time spent waiting for room in the ring
+      if( put - start > BATCH_NSEC )
+	target = target > 1 ? target / 2 : 1;
+      else if( target < so->batch )
+	target *= 2;
+      ring_put_batch( &so->ring, batch, n ); // wait for free slots and fill them
+      start = now( );
+      waitns += start - put;
+      n = bytes = 0;
+    }
+  }
+  if( n > 0 ) { // the last (partial) batch
+    long put = now( );
+    ring_put_batch( &so->ring, batch, n );
+    waitns += now( ) - put;
+  }
+  parg->runns = now( ) - begin;
+  parg->waitns = waitns + in->readns;
+  atomic_fetch_sub( &so->producing, 1 ); // main stops growing the pool once we're all done
+  free( in->carry );
+  free( in );
+  ob_destroy( &out );
+  printf( "Prod %ld: %d lines\n", pid, i );
+  *ret = i;
+  pthread_exit( ret );
+} // producer
+
+void *
+consumer( void *arg ) {
+  targ_t *targ = (targ_t *) arg;
+  long tid = targ->tid;    // thread's 'id'
+  so_t *so = targ->soptr;  // shared object
+  int *ret = malloc( sizeof(int) );  // return value -- the number of lines consumed
+  int i = 0;
+  line_t batch[MAXBATCH];
+  size_t n;
+  outbuf_t *out = &so->outs[tid]; // our output
+  void *ctx = so->work->init( so->workarg ); // our state for the work function
+  char report[128]; // what the work function found
+  long begin = now( ), get = begin, waitns = 0; // when we started, started to wait, and how long we've waited
+  long idlens = so->mincons < so->maxcons ? IDLE_NSEC : -1; // how long we wait before we retire
+  bool idle; // we waited 'idlens' for nothing
+  printf("Consumer %ld starting\n",tid);
+  for( ; ; ) {
+    n = ring_get_batch_wait( &so->ring, batch, so->batch, idlens, &idle ); // wait for lines and take a batch
+    waitns += now( ) - get;
+    if( n == 0 && !idle ) // the ring is closed and drained
+      break;
+    if( n == 0 ) { // nothing to do for a while: retire, unless the pool is as small as it gets
+      int rc;
+      bool retire;
+      if( (rc = pthread_mutex_lock( &so->poollock )) != 0 )
+	err_abort( rc, "lock mutex" );
+      if( (retire = so->active > so->mincons) ) {
+	so->active--;
+	so->retired++;
+	targ->state = CS_RETIRED;
+      }
+      if( (rc = pthread_mutex_unlock( &so->poollock )) != 0 )
+	err_abort( rc, "unlock mutex" );
+      if( retire )
+	break;
+      get = now( );
+      continue;
+    }
+    // we're not holding the lock: the lines are ours now
+    for( size_t b = 0; b < n; ++b ) {
+      line_t *item = &batch[b];
+      so->work->line( ctx, item->line, item->len );
+      if( !so->quiet )
+	ob_printf( out, item->linenum, "Consumer %ld: [%d:%d] %.*s",
+		   tid, i, item->linenum, (int) item->len, item->line );
+      i++;
+      if( !so->map ) // a view into the mapping has no buffer to give back
+	lp_put( &so->pool, item->line ); // recycle the buffer
+    }
+    get = now( );
+  }
+  targ->waitns += waitns;
+  if( !out->keep ) // write out the rest of our output
+    ob_flush( out );
+  targ->runns += now( ) - begin;
+  so->work->report( ctx, report, sizeof(report) );
+  so->work->fini( ctx );
+  printf( "Cons %ld: %d lines, %s\n", tid, i, report );
+  *ret = i;
+  return ret; // a task of the pool: its worker lives on
+} // consumer
+
+static bool
+grow( so_t *so, tpool_t *tp, tp_future_t *cons, targ_t *carg ) {
+  int rc, i;
+  if( (rc = pthread_mutex_lock( &so->poollock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  if( so->active >= so->maxcons ) { // all hands on deck already
+    if( (rc = pthread_mutex_unlock( &so->poollock )) != 0 )
+      err_abort( rc, "unlock mutex" );
+    return false;
+  }
+  for( i = 0; carg[i].state == CS_RUNNING; ++i ) // fewer than 'maxcons' run: there is a slot
+    ;
+  enum cstate was = carg[i].state;
+  carg[i].state = CS_RUNNING; // it's ours
+  so->active++;
+  so->started++;
+  if( (rc = pthread_mutex_unlock( &so->poollock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+  if( was == CS_RETIRED ) // its last consumer is on its way out (or gone already)
+    join( tp, cons, i );
+  tp_submit( tp, consumer, &carg[i], &cons[i] );
+  return true;
+} // grow
+
+static void
+join( tpool_t *tp, tp_future_t *cons, int i ) {
+  void *ret = tp_wait( tp, &cons[i] );
+  printf( "main: consumer %d joined with %d lines consumed \n", i, *((int *) ret) );
+  free( ret );
+} // join
+
+bool
+nextline( so_t *so, in_t *in, line_t *item ) {
+  while( in->next == in->nspans ) { // all lines split off so far are gone: split some more
+    size_t used;
+    in->base = in->buf + in->pos;
+    in->nspans = linescan( in->base, in->size - in->pos, in->spans, NUM_SPANS, &used );
+    in->next = 0;
+    in->pos += used;
+    if( in->nspans > 0 )
+      break;
+    // there is no complete line in what is left of 'buf'
+    size_t left = in->size - in->pos;
+    if( in->buf == in->carry && left == 0 && in->resume < in->chunklen ) {
+      // the line carried over is gone: go on with the rest of the lent buffer
+      in->buf = in->chunk;
+      in->size = in->chunklen;
+      in->pos = in->resume;
+      in->resume = in->chunklen;
+      continue;
+    }
+    if( in->eof || ( in->buf == in->carry && left == READSIZE ) ) {
+      // the last line lacks a '\n', or a line doesn't fit into 'carry': hand on what we have
+      if( left == 0 )
+	return false;
+      in->spans[0].off = 0;
+      in->spans[0].len = left;
+      in->nspans = 1;
+      in->pos = in->size;
+      break;
+    }
+    // keep the start of the incomplete line in 'carry', give the lent buffer back, and borrow the next
+    memmove( in->carry, in->buf + in->pos, left );
+    if( in->chunk )
+      rd_release( &so->reader );
+    long start = now( );
+    ssize_t n = rd_next( &so->reader, &in->chunk );
+    in->readns += now( ) - start;
+    if( n < 0 )
+      errno_abort( "read input file" );
+    if( n == 0 ) { // the file has ended: what is in 'carry' is the last line
+      in->chunk = NULL;
+      in->chunklen = in->resume = 0;
+      in->buf = in->carry;
+      in->size = left;
+      in->pos = 0;
+      in->eof = true;
+      continue;
+    }
+    in->chunklen = n;
+    if( left == 0 ) { // nothing carried over: split the lent buffer right away
+      in->buf = in->chunk;
+      in->size = in->chunklen;
+      in->pos = 0;
+      in->resume = in->chunklen;
+      continue;
+    }
+    // finish the carried line with the start of the lent buffer (up to its first '\n')
+    char *nl = memchr( in->chunk, '\n', n );
+    size_t end = nl ? (size_t) ( nl - in->chunk ) + 1 : (size_t) n;
+    size_t take = end < READSIZE - left ? end : READSIZE - left;
+    memcpy( in->carry + left, in->chunk, take );
+    in->buf = in->carry;
+    in->size = left + take;
+    in->pos = 0;
+    in->resume = take;
+  } // while
+  span_t *sp = &in->spans[in->next];
+  if( so->map ) { // hand on a view into the mapping
+    item->line = in->base + sp->off;
+    item->len = sp->len;
+    in->next++;
+    return true;
+  }
+  // copy the line into a buffer from the pool;
+  // like fgets(), hand on a line that is too long for it in pieces
+  size_t len = sp->len < MAXLINE - 1 ? sp->len : MAXLINE - 1;
+  item->line = lp_get( &so->pool );
+  memcpy( item->line, in->base + sp->off, len );
+  item->line[len] = '\0';
+  item->len = len;
+  sp->off += len;
+  if( (sp->len -= len) == 0 )
+    in->next++;
+  return true;
+} // nextline
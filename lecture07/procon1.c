@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include "latency.h"
 
 #define MAXLINE 100000
 
@@ -47,6 +48,7 @@ producer( void *arg ) {
   char *line;
   for( ; ( line = readline( rfile ) ); ++i ) {
     so->linenum = i;            // current line number
+    lat_put( i );
     so->line = line;		// put line into the buffer
     fprintf( stdout, "Prod: [%d] %s", i, line );
   }
@@ -65,6 +67,7 @@ consumer( void *arg ) {
   char *line = NULL;
   while( (line = so->line) ) {
     ++i;
+    lat_get( so->linenum );
     len = strlen( line ); // the job the consumer does: compute the length of line read
     fprintf( stdout, "Cons: [%d:%d] %s", i, so->linenum, line );
   }
@@ -89,6 +92,8 @@ main (int argc, char *argv[]){
     exit( EXIT_FAILURE );
   }
 
+  lat_init( ); // record handoff latencies for pcbench (if asked to)
+
   // shared object
   so_t *share = malloc( sizeof(so_t) );
   // initialize the shared object
@@ -128,6 +133,7 @@ main (int argc, char *argv[]){
     exit( EXIT_FAILURE );
   } // if
   printf( "main: consumer joined with %d\n", *ret );
+  lat_dump( );
 
   pthread_exit( NULL );
   exit( EXIT_SUCCESS );
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include "latency.h"
 
 #define MAXLINE 100000
 
@@ -46,6 +47,7 @@ producer( void *arg ) {
   char *line;
   for( ; ( line = readline( rfile ) ); ++i ) {
     so->linenum = i;            // current line number
+    lat_put( i );
     so->line = line;		// put line into the buffer
     fprintf( stdout, "Prod: [%d] %s", i, line );
     sched_yield( );
@@ -66,6 +68,7 @@ consumer( void *arg ) {
   sched_yield( );
   while( (line = so->line) ) {
     ++i;
+    lat_get( so->linenum );
     len = strlen( line ); // the job the consumer does: compute the length of line read
     fprintf( stdout, "Cons: [%d:%d] %s", i, so->linenum, line );
     sched_yield( );
@@ -91,6 +94,8 @@ main (int argc, char *argv[]){
     exit( EXIT_FAILURE );
   }
 
+  lat_init( ); // record handoff latencies for pcbench (if asked to)
+
   // shared object
   so_t *share = malloc( sizeof(so_t) );
   // initialize the shared object
@@ -130,6 +135,7 @@ main (int argc, char *argv[]){
     exit( EXIT_FAILURE );
   } // if
   printf( "main: consumer joined with %d\n", *ret );
+  lat_dump( );
 
   pthread_exit( NULL );
   exit( EXIT_SUCCESS );
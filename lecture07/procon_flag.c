@@ -4,19 +4,55 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <features.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "spsc.h"
+#include "linepool.h"
+#include "spinwait.h"
+#include "latency.h"
 
-#define MAXLINE 100000
+#define MAXLINE 1000  // bytes per pool buffer: a longer line is handed over in pieces, as in proNcon.c
+
+/*
+  two protocols are available:
+
+  *) by default, the producer and the consumer hand a single line over
+     through 'line' and wait for each other on 'flag'; 'flag' is atomic,
+     so that the line is seen by the other side once the flag is;
+
+  *) with '-q slots', they share the lock-free ring 'queue' (see spsc.h) instead,
+     and the producer marks the end of the input with a NULL line;
+
+  *) nobody spins without end: all waits go through sw_wait() (see spinwait.h),
+     which spins briefly, then yields, then sleeps until the other side calls sw_wake();
+     'flagged' is the wait for a change of 'flag', 'notfull' and 'notempty' the waits
+     for the ring;
+
+  *) either way, lines are read into buffers from 'pool' (see linepool.h)
+     and recycled once the consumer is done with them
+*/
 
 typedef struct sharedobject {
   FILE *rfile;  // file to read lines from
   int linenum;  // line number
   char *line;   // next line to have read
-  bool flag;     // to coordinate between a producer and consumer
+  atomic_bool flag;  // to coordinate between a producer and consumer
+  spsc_t *queue; // lock-free ring of lines ('-q' only)
+  linepool_t pool; // recycled line buffers
+  spinwait_t flagged;   // wait for 'flag' to change
+  spinwait_t notfull;   // wait for a free slot in 'queue'
+  spinwait_t notempty;  // wait for a line in 'queue'
 } so_t;
 
-// read a line from a file and return a new line string object on the heap
+// a push or pop to retry in sw_wait()
+typedef struct attempt {
+  spsc_t *queue;
+  line_t *item;
+} attempt_t;
+
+// read a line from a file into a buffer from 'pool'
 // return NULL if no lines to read
-char *readline( FILE *rfile );
+char *readline( FILE *rfile, linepool_t *pool );
 // set flag to true and wait till it becomes false
 void markfull( so_t *so );
 // set flag to false and wait till it becomes true
@@ -25,28 +61,59 @@ void markempty( so_t *so );
 void *producer( void *arg );
 // remove lines from the shared buffer
 void *consumer( void *arg );
+// read lines from a file, put them into the lock-free ring
+void *producer_q( void *arg );
+// take lines out of the lock-free ring
+void *consumer_q( void *arg );
 
 
 char
-*readline( FILE *rfile ) {
-  char buf[MAXLINE];
-  int len = 0;
-  char *result = NULL;
-  char *line = fgets( buf, MAXLINE, rfile );
-  if( line ) {
-    len = strnlen( buf, MAXLINE );
-    result = strncpy( malloc( len+1 ), buf, len+1 );
+*readline( FILE *rfile, linepool_t *pool ) {
+  char *buf = lp_get( pool );
+  if( !fgets( buf, MAXLINE, rfile ) ) {
+    lp_put( pool, buf ); // nothing read: the buffer goes back
+    return NULL;
   }
-  return result;
+  return buf;
 } // readline
 
+// conditions for sw_wait()
+static bool
+isfull( void *arg ) {
+  return atomic_load( &( (so_t *) arg )->flag );
+} // isfull
+
+static bool
+isempty( void *arg ) {
+  return !atomic_load( &( (so_t *) arg )->flag );
+} // isempty
+
+static bool
+trypush( void *arg ) {
+  attempt_t *a = arg;
+  return spsc_push( a->queue, a->item );
+} // trypush
+
+static bool
+trypop( void *arg ) {
+  attempt_t *a = arg;
+  return spsc_pop( a->queue, a->item );
+} // trypop
+
+// set 'flag' to 'val' and let the other side know
+static void
+setflag( so_t *so, bool val ) {
+  atomic_store( &so->flag, val );
+  sw_wake( &so->flagged );
+} // setflag
+
 // mark the buffer as full
 // this is "signalled" by setting 'flag' to true
 // and then blocking until 'flag' is back to false
 void
 markfull( so_t *so ) {
-  so->flag = true;
-  while( so->flag ) {}
+  setflag( so, true );
+  sw_wait( &so->flagged, isempty, so );
 } // markfull
 
 // mark the buffer as empty
@@ -54,8 +121,8 @@ markfull( so_t *so ) {
 // and then blocking until 'flag' is back to 1
 void
 markempty( so_t *so ) {
-  so->flag = false;
-  while( !so->flag ) {}
+  setflag( so, false );
+  sw_wait( &so->flagged, isfull, so );
 } // markempy
 
 // producer reads lines from a file, puts them into the buffer
@@ -66,16 +133,18 @@ producer( void *arg ) {
   int i = 0; // to count lines produced
   char *line = NULL; // next line
   // read a line from the file; keep going while there are lines to read
-  while ( (line = readline( so->rfile )) ) { 
+  while ( (line = readline( so->rfile, &so->pool )) ) { 
     so->linenum = i++;
     so->line = line;   // put the line into the shared buffer
+    lat_put( so->linenum );
     markfull( so );   // mark the buffer as full; wait for it to become empty
     fprintf( stdout, "Prod: [%d] %s", i, line ); // for visualization
+    lp_put( &so->pool, line ); // the consumer is done with the line: recycle it
   }
   // to terminate the consumer's loop (note: 'line' == NULL, but so->line != NULL)
   so->line = NULL;
   // make sure consumer is not blocked
-  so->flag = true;
+  setflag( so, true );
   printf( "Prod: %d lines\n", i );
   *ret = i;
   pthread_exit( ret );
@@ -88,55 +157,142 @@ consumer( void *arg ) {
   int *ret = malloc( sizeof(int) ); // return value -- the number of lines consumed
   int i = 0, len;
   char *line;
-  while( !so->flag )		// wait for producer
-    ;
+  sw_wait( &so->flagged, isfull, so );  // wait for producer
   while( (line = so->line) ) {  // while there're lines in the buffer
     ++i;
+    lat_get( so->linenum );
     len = strlen( line );
     printf( "Cons: [%d:%d] %s", i, so->linenum, line ); // for visualization
     markempty( so );  // mark the buffer as empty; wait for it to become full
   }
   // make sure producer is not blocked
-  so->flag = false;
+  setflag( so, false );
   printf("Cons: %d lines\n", i);
   *ret = i;
   pthread_exit( ret );
 }
 
+// producer reads lines from a file, pushes them into the lock-free ring
+void *
+producer_q( void *arg ) {
+  so_t *so = (so_t *) arg;
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines produced
+  int i = 0; // to count lines produced
+  line_t item; // next line
+  attempt_t push = { so->queue, &item };
+  while( (item.line = readline( so->rfile, &so->pool )) ) {
+    item.len = strlen( item.line );
+    item.linenum = i++;
+    fprintf( stdout, "Prod: [%d] %s", item.linenum, item.line ); // for visualization
+    lat_put( item.linenum );
+    if( !spsc_push( so->queue, &item ) ) // the ring is full: wait for the consumer
+      sw_wait( &so->notfull, trypush, &push );
+    sw_wake( &so->notempty );
+  }
+  // to terminate the consumer's loop
+  item.line = NULL;
+  if( !spsc_push( so->queue, &item ) )
+    sw_wait( &so->notfull, trypush, &push );
+  sw_wake( &so->notempty );
+  printf( "Prod: %d lines\n", i );
+  *ret = i;
+  pthread_exit( ret );
+} // producer_q
+
+// consumer pops lines from the lock-free ring
+void *
+consumer_q( void *arg ) {
+  so_t *so = (so_t *) arg;
+  int *ret = malloc( sizeof(int) ); // return value -- the number of lines consumed
+  int i = 0;
+  size_t len = 0;
+  line_t item;
+  attempt_t pop = { so->queue, &item };
+  for( ; ; ) {
+    if( !spsc_pop( so->queue, &item ) ) // the ring is empty: wait for the producer
+      sw_wait( &so->notempty, trypop, &pop );
+    sw_wake( &so->notfull );
+    if( !item.line ) // no more lines
+      break;
+    lat_get( item.linenum );
+    ++i;
+    len += item.len;
+    printf( "Cons: [%d:%d] %s", i, item.linenum, item.line ); // for visualization
+    lp_put( &so->pool, item.line ); // recycle the buffer
+  }
+  printf( "Cons: %d lines, %zu bytes\n", i, len );
+  *ret = i;
+  pthread_exit( ret );
+} // consumer_q
+
 int
 main (int argc, char *argv[]){
 
+  size_t slots = 0; // capacity of the lock-free ring; 0 for the flag protocol
+  int opt;
+  while( (opt = getopt( argc, argv, "q:" )) != -1 ) {
+    switch( opt ) {
+    case 'q':
+      slots = strtoul( optarg, NULL, 10 );
+      break;
+    default:
+      fprintf( stderr, "Usage: %s [-q slots] filename\n", argv[0] );
+      exit( EXIT_FAILURE );
+    }
+  }
+
   // check use
-  if( argc < 2 ){
-    fprintf( stderr, "Usage: %s filename\n", argv[0] );
+  if( optind >= argc ){
+    fprintf( stderr, "Usage: %s [-q slots] filename\n", argv[0] );
     exit( EXIT_FAILURE );
   }
 
   // open a file
-  FILE *rfile = fopen( (char *) argv[1], "r" );
+  FILE *rfile = fopen( argv[optind], "r" );
   if( !rfile ) {
-    fprintf( stderr, "error opening %s\n", argv[0] );
+    fprintf( stderr, "error opening %s\n", argv[optind] );
     exit( EXIT_FAILURE );
   }
 
-  // shared object
-  so_t *share = malloc( sizeof(so_t) );
+  lat_init( ); // record handoff latencies for pcbench (if asked to)
+
+  // shared object (the waits sit on cache lines of their own)
+  so_t *share = aligned_alloc( CACHELINE, sizeof(so_t) );
+  if( !share )
+    errno_abort( "allocate shared object" );
   // initialize the shared object
   share->rfile = rfile;
   share->line = NULL;
+  atomic_init( &share->flag, false );
+  share->queue = NULL;
+  sw_init( &share->flagged );
+  sw_init( &share->notfull );
+  sw_init( &share->notempty );
+  size_t nbufs = 2; // lines in flight: one in the buffer, one being read
+  if( slots > 0 ) {
+    // the ring's indices must sit on cache lines of their own
+    if( !( share->queue = aligned_alloc( CACHELINE, sizeof(spsc_t) ) ) )
+      errno_abort( "allocate spsc" );
+    spsc_init( share->queue, slots );
+    // lines in flight: a full ring, one being read, one being consumed
+    nbufs = share->queue->mask + 1 + 2;
+  }
+  lp_init( &share->pool, nbufs, MAXLINE );
+  void *(*prodfun)( void * ) = slots > 0 ? producer_q : producer;
+  void *(*consfun)( void * ) = slots > 0 ? consumer_q : consumer;
 
   int rc = 0; // return code for pthread_create() and pthread_join()
   
   // producer thread
   pthread_t prod;
-  if( ( rc = pthread_create( &prod, NULL, producer, share ) ) ){
+  if( ( rc = pthread_create( &prod, NULL, prodfun, share ) ) ){
     printf( "ERROR; return code from pthread_create() is %d\n", rc );
     exit( EXIT_FAILURE );
   } // if
   
   // consumer thread
   pthread_t cons;
-  if( ( rc = pthread_create( &cons, NULL, consumer, share ) ) ){
+  if( ( rc = pthread_create( &cons, NULL, consfun, share ) ) ){
       printf( "ERROR; return code from pthread_create() is %d\n", rc );
       exit( EXIT_FAILURE );
   } // if
@@ -158,6 +314,13 @@ main (int argc, char *argv[]){
     exit( EXIT_FAILURE );
   } // if
   printf( "main: consumer joined with %d\n", *ret );
+  if( slots > 0 ) {
+    sw_report( &share->notfull, "main: producer" );
+    sw_report( &share->notempty, "main: consumer" );
+  }
+  else
+    sw_report( &share->flagged, "main: both" );
+  lat_dump( );
 
   pthread_exit( NULL );
   exit( EXIT_SUCCESS );
@@ -0,0 +1,194 @@
+// a micro-benchmark of the queues used by the producer-consumer programs:
+// one producer pushes 'n' lines through a queue to 'nc' consumers,
+// and we report lines per second for every queue
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "errors.h"
+#include "ring.h"
+#include "spsc.h"
+#include "mpmc.h"
+
+#define NUM_LINES 10000000
+#define NUM_SLOTS 1024
+#define NUM_CONSUMERS 1
+
+// a queue under test
+typedef struct bench {
+  const char *name;             // name printed in the report
+  void *(*producer)( void * );  // thread functions that move the lines
+  void *(*consumer)( void * );
+  int maxconsumers;             // 1 for single-consumer queues, 0 for no limit
+} bench_t;
+
+// shared object
+typedef struct sharedobject {
+  long n;        // number of lines to move
+  int nc;        // number of consumers
+  ring_t ring;   // mutex/condvar ring
+  spsc_t *spsc;  // lock-free ring
+  mpmc_t *mpmc;  // lock-free queue
+} so_t;
+
+static char text[] = "a line to hand over\n";
+
+// the mutex/condvar ring (ring.c)
+void *
+ring_producer( void *arg ) {
+  so_t *so = arg;
+  line_t item = { text, sizeof(text) - 1, 0 };
+  for( long i = 0; i < so->n; ++i ) {
+    item.linenum = (int) i;
+    ring_put( &so->ring, &item );
+  }
+  ring_close( &so->ring );
+  return NULL;
+} // ring_producer
+
+void *
+ring_consumer( void *arg ) {
+  so_t *so = arg;
+  line_t item;
+  size_t len = 0;
+  while( ring_get( &so->ring, &item ) )
+    len += item.len;
+  return (void *) len;
+} // ring_consumer
+
+// the lock-free ring (spsc.h); the end is marked with a NULL line
+void *
+spsc_producer( void *arg ) {
+  so_t *so = arg;
+  line_t item = { text, sizeof(text) - 1, 0 };
+  for( long i = 0; i <= so->n; ++i ) {
+    item.linenum = (int) i;
+    if( i == so->n )
+      item.line = NULL;
+    while( !spsc_push( so->spsc, &item ) )
+      sched_yield( );
+  }
+  return NULL;
+} // spsc_producer
+
+void *
+spsc_consumer( void *arg ) {
+  so_t *so = arg;
+  line_t item;
+  size_t len = 0;
+  for( ; ; ) {
+    while( !spsc_pop( so->spsc, &item ) )
+      sched_yield( );
+    if( !item.line )
+      break;
+    len += item.len;
+  }
+  return (void *) len;
+} // spsc_consumer
+
+// the lock-free queue (mpmc.c); the end is marked with one NULL line per consumer
+void *
+mpmc_producer( void *arg ) {
+  so_t *so = arg;
+  line_t item = { text, sizeof(text) - 1, 0 };
+  for( long i = 0; i < so->n + so->nc; ++i ) {
+    item.linenum = (int) i;
+    if( i == so->n )
+      item.line = NULL;
+    while( !mpmc_push( so->mpmc, &item ) )
+      sched_yield( );
+  }
+  return NULL;
+} // mpmc_producer
+
+void *
+mpmc_consumer( void *arg ) {
+  so_t *so = arg;
+  line_t item;
+  size_t len = 0;
+  for( ; ; ) {
+    while( !mpmc_pop( so->mpmc, &item ) )
+      sched_yield( );
+    if( !item.line )
+      break;
+    len += item.len;
+  }
+  return (void *) len;
+} // mpmc_consumer
+
+static bench_t benches[] = {
+  { "mutex+cv ring", ring_producer, ring_consumer, 0 },
+  { "lock-free spsc", spsc_producer, spsc_consumer, 1 },
+  { "lock-free mpmc", mpmc_producer, mpmc_consumer, 0 },
+};
+
+// wall-clock time in seconds
+static double
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+} // now
+
+int
+main( int argc, char *argv[] ) {
+
+  long n = argc > 1 ? atol( argv[1] ) : NUM_LINES;        // lines to move
+  size_t slots = argc > 2 ? strtoul( argv[2], NULL, 10 ) : NUM_SLOTS; // queue capacity
+  int nc = argc > 3 ? atoi( argv[3] ) : NUM_CONSUMERS;                // consumers
+  int rc;
+
+  if( n <= 0 || slots == 0 || nc <= 0 ) {
+    fprintf( stderr, "Usage: %s [lines [slots [consumers]]]\n", argv[0] );
+    exit( EXIT_FAILURE );
+  }
+
+  so_t *so = malloc( sizeof(so_t) );
+  pthread_t *cons = malloc( nc * sizeof(pthread_t) );
+  so->n = n;
+  so->nc = nc;
+  if( !( so->spsc = aligned_alloc( CACHELINE, sizeof(spsc_t) ) ) )
+    errno_abort( "allocate spsc" );
+
+  printf( "%-16s %9s %12s %10s %14s\n", "queue", "consumers", "lines", "seconds", "lines/sec" );
+  for( size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b ) {
+    if( benches[b].maxconsumers && nc > benches[b].maxconsumers )
+      continue; // this queue can't serve that many consumers
+    ring_init( &so->ring, slots );
+    spsc_init( so->spsc, slots );
+    so->mpmc = mpmc_create( slots );
+    pthread_t prod;
+    size_t total = 0;
+    double start = now( );
+    if( (rc = pthread_create( &prod, NULL, benches[b].producer, so )) != 0 )
+      err_abort( rc, "create producer thread" );
+    for( int c = 0; c < nc; ++c )
+      if( (rc = pthread_create( &cons[c], NULL, benches[b].consumer, so )) != 0 )
+	err_abort( rc, "create consumer thread" );
+    if( (rc = pthread_join( prod, NULL )) != 0 )
+      err_abort( rc, "join producer thread" );
+    for( int c = 0; c < nc; ++c ) {
+      void *len;
+      if( (rc = pthread_join( cons[c], &len )) != 0 )
+	err_abort( rc, "join consumer thread" );
+      total += (size_t) len;
+    }
+    double secs = now( ) - start;
+    if( total != (size_t) n * ( sizeof(text) - 1 ) )
+      fprintf( stderr, "%s: lost lines!\n", benches[b].name );
+    printf( "%-16s %9d %12ld %10.3f %14.0f\n", benches[b].name, nc, n, secs, n / secs );
+    ring_destroy( &so->ring );
+    spsc_destroy( so->spsc );
+    mpmc_destroy( so->mpmc );
+  } // for
+
+  free( cons );
+  free( so->spsc );
+  free( so );
+  exit( EXIT_SUCCESS );
+
+} // main
@@ -0,0 +1,413 @@
+// a read-ahead reader on top of io_uring or a reader thread, with a pread(2) fallback
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "errors.h"
+#include "reader.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+static long
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // now
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define HAVE_URING 1
+
+static int
+uring_setup( unsigned entries, struct io_uring_params *p ) {
+  return (int) syscall( __NR_io_uring_setup, entries, p );
+} // uring_setup
+
+static int
+uring_enter( int ring, unsigned submit, unsigned wait, unsigned flags ) {
+  return (int) syscall( __NR_io_uring_enter, ring, submit, wait, flags, NULL, 0 );
+} // uring_enter
+
+static int
+uring_register( int ring, unsigned op, void *arg, unsigned n ) {
+  return (int) syscall( __NR_io_uring_register, ring, op, arg, n );
+} // uring_register
+
+// set up a ring for 'depth' reads; return false if there is no io_uring to be had
+static bool
+uring_open( reader_t *r ) {
+  struct io_uring_params p;
+  memset( &p, 0, sizeof(p) );
+  if( getenv( "PCNOURING" ) ) // play an old kernel, to try the fallback
+    return false;
+  if( (r->ring = uring_setup( r->depth, &p )) < 0 )
+    return false;
+  r->sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP; // both rings in one mapping
+  if( single )
+    r->sqsize = r->cqsize = r->sqsize > r->cqsize ? r->sqsize : r->cqsize;
+  r->sqmap = mmap( NULL, r->sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   r->ring, IORING_OFF_SQ_RING );
+  if( r->sqmap == MAP_FAILED )
+    errno_abort( "map submission ring" );
+  r->cqmap = single ? r->sqmap
+    : mmap( NULL, r->cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	    r->ring, IORING_OFF_CQ_RING );
+  if( r->cqmap == MAP_FAILED )
+    errno_abort( "map completion ring" );
+  r->sqentries = p.sq_entries;
+  r->sqes = mmap( NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, r->ring, IORING_OFF_SQES );
+  if( r->sqes == MAP_FAILED )
+    errno_abort( "map submission entries" );
+  char *sq = r->sqmap, *cq = r->cqmap;
+  r->sqtail = (unsigned *) ( sq + p.sq_off.tail );
+  r->sqmask = (unsigned *) ( sq + p.sq_off.ring_mask );
+  r->sqarray = (unsigned *) ( sq + p.sq_off.array );
+  r->cqhead = (unsigned *) ( cq + p.cq_off.head );
+  r->cqtail = (unsigned *) ( cq + p.cq_off.tail );
+  r->cqmask = (unsigned *) ( cq + p.cq_off.ring_mask );
+  r->cqes = (struct io_uring_cqe *) ( cq + p.cq_off.cqes );
+
+  // register the buffers, so that a read needn't map its buffer; if the kernel won't
+  // (RLIMIT_MEMLOCK on older kernels), plain reads into them do just as well
+  struct iovec iov[RD_MAXDEPTH];
+  for( int b = 0; b < r->depth; ++b ) {
+    iov[b].iov_base = r->bufs[b].data;
+    iov[b].iov_len = r->bufsize;
+  }
+  r->fixed = uring_register( r->ring, IORING_REGISTER_BUFFERS, iov, r->depth ) == 0;
+  return true;
+} // uring_open
+
+static void
+uring_close( reader_t *r ) {
+  munmap( r->sqes, r->sqentries * sizeof(struct io_uring_sqe) );
+  if( r->cqmap != r->sqmap )
+    munmap( r->cqmap, r->cqsize );
+  munmap( r->sqmap, r->sqsize );
+  close( r->ring );
+  r->ring = -1;
+} // uring_close
+
+// start a read of the next 'bufsize' bytes of the file into buffer 'b'
+static void
+submit( reader_t *r, int b ) {
+  rdbuf_t *buf = &r->bufs[b];
+  unsigned tail = *r->sqtail; // we're the only one who moves the tail
+  unsigned idx = tail & *r->sqmask;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+  memset( sqe, 0, sizeof(*sqe) );
+  sqe->opcode = r->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = r->fd;
+  sqe->addr = (unsigned long) buf->data;
+  sqe->len = r->bufsize;
+  sqe->off = r->next;
+  sqe->buf_index = b;
+  sqe->user_data = b;
+  r->sqarray[idx] = idx;
+  __atomic_store_n( r->sqtail, tail + 1, __ATOMIC_RELEASE ); // publish the entry
+  if( uring_enter( r->ring, 1, 0, 0 ) < 0 )
+    errno_abort( "submit read" );
+  buf->off = r->next;
+  buf->state = RD_INFLIGHT;
+  r->next += r->bufsize;
+  r->inflight++;
+  r->reads++;
+} // submit
+
+// collect the reads that have completed; wait for one if 'wait'
+static void
+reap( reader_t *r, bool wait ) {
+  unsigned head = *r->cqhead; // we're the only one who moves the head
+  if( wait && head == __atomic_load_n( r->cqtail, __ATOMIC_ACQUIRE ) )
+    if( uring_enter( r->ring, 0, 1, IORING_ENTER_GETEVENTS ) < 0 && errno != EINTR )
+      errno_abort( "wait for read" );
+  for( ; head != __atomic_load_n( r->cqtail, __ATOMIC_ACQUIRE ); ++head ) {
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cqmask];
+    rdbuf_t *buf = &r->bufs[cqe->user_data];
+    buf->res = cqe->res;
+    if( cqe->res > 0 )
+      r->bytes += cqe->res;
+    buf->state = RD_DONE;
+    r->inflight--;
+  }
+  __atomic_store_n( r->cqhead, head, __ATOMIC_RELEASE ); // give the entries back
+} // reap
+#endif // __linux__ && __NR_io_uring_setup
+
+// read into 'buf' from 'from' on until it is full or the file ends
+static size_t
+fill( reader_t *r, rdbuf_t *buf, size_t from ) {
+  long start = now( );
+  while( from < r->bufsize ) {
+    ssize_t rd = pread( r->fd, buf->data + from, r->bufsize - from, buf->off + from );
+    if( rd < 0 && errno != EINTR )
+      errno_abort( "read input file" );
+    if( rd == 0 )
+      break;
+    if( rd > 0 ) {
+      from += rd;
+      r->bytes += rd;
+    }
+  }
+  r->readns += now( ) - start;
+  return from;
+} // fill
+
+// the reader thread: fill empty buffers with read(2) until the file ends
+static void *
+readahead( void *arg ) {
+  reader_t *r = arg;
+  line_t chunk;
+  while( ring_get( &r->empty, &chunk ) ) { // wait for an empty buffer
+    long start = now( );
+    size_t len = 0;
+    while( len < r->bufsize ) { // fill it (a read(2) may come back short)
+      ssize_t rd = read( r->fd, chunk.line + len, r->bufsize - len );
+      if( rd < 0 && errno != EINTR )
+	errno_abort( "read input file" );
+      if( rd == 0 )
+	break;
+      if( rd > 0 )
+	len += rd;
+      r->reads++;
+    }
+    r->readns += now( ) - start;
+    r->bytes += len;
+    chunk.len = len;
+    ring_put( &r->full, &chunk );
+    if( len < r->bufsize ) // the file ended here
+      break;
+  }
+  ring_close( &r->full ); // rd_read() gets the rest, and then sees the end
+  return NULL;
+} // readahead
+
+void
+rd_init( reader_t *r, int fd, size_t bufsize, enum rd_mode mode, int depth ) {
+  memset( r, 0, sizeof(*r) );
+  r->fd = fd;
+  r->bufsize = bufsize;
+  r->mode = mode;
+  r->depth = depth < RD_MAXDEPTH ? depth : RD_MAXDEPTH;
+  r->ring = -1;
+  if( mode == RD_THREAD && r->depth > 0 ) {
+    int rc;
+    ring_init( &r->empty, r->depth );
+    ring_init( &r->full, r->depth );
+    for( int b = 0; b < r->depth; ++b ) { // every buffer starts out empty
+      line_t chunk = { NULL, 0, b };
+      if( !( r->bufs[b].data = chunk.line = malloc( bufsize ) ) )
+	errno_abort( "allocate read buffer" );
+      ring_put( &r->empty, &chunk );
+    }
+    if( (rc = pthread_create( &r->thread, NULL, readahead, r )) != 0 )
+      err_abort( rc, "create reader thread" );
+    return;
+  }
+#ifdef HAVE_URING
+  if( mode == RD_URING && r->depth > 0 ) {
+    for( int b = 0; b < r->depth; ++b )
+      if( !( r->bufs[b].data = aligned_alloc( 4096, bufsize ) ) )
+	errno_abort( "allocate read buffer" );
+    if( uring_open( r ) ) {
+      for( int b = 0; b < r->depth; ++b ) // get them all going
+	submit( r, b );
+      return;
+    }
+    for( int b = 0; b < r->depth; ++b ) { // rd_next() allocates a buffer of its own
+      free( r->bufs[b].data );
+      r->bufs[b].data = NULL;
+    }
+  }
+#endif
+  r->mode = RD_PREAD; // no io_uring: pread() it is
+  r->depth = 0;
+} // rd_init
+
+void
+rd_destroy( reader_t *r ) {
+  if( r->mode == RD_THREAD ) {
+    int rc;
+    ring_close( &r->empty ); // in case we stopped before the end of the file
+    if( (rc = pthread_join( r->thread, NULL )) != 0 )
+      err_abort( rc, "join reader thread" );
+    ring_destroy( &r->empty );
+    ring_destroy( &r->full );
+  }
+#ifdef HAVE_URING
+  if( r->ring >= 0 ) {
+    while( r->inflight > 0 ) // the kernel may still be writing into the buffers
+      reap( r, true );
+    uring_close( r );
+  }
+#endif
+  for( int b = 0; b < r->depth; ++b )
+    free( r->bufs[b].data );
+  if( r->mode == RD_PREAD ) // rd_next()'s buffer (if any)
+    free( r->bufs[0].data );
+} // rd_destroy
+
+#ifdef HAVE_URING
+// wait for the read into the current buffer, and make sure it holds all it should
+static rdbuf_t *
+ready( reader_t *r ) {
+  rdbuf_t *buf = &r->bufs[r->cur];
+  if( buf->state == RD_INFLIGHT ) { // we've caught up with the disk
+    r->stalls++;
+    while( buf->state == RD_INFLIGHT )
+      reap( r, true );
+  }
+  else
+    reap( r, false );
+  if( buf->state == RD_DONE ) {
+    if( buf->res < 0 ) // the read failed: do it again the old way
+      buf->len = fill( r, buf, 0 );
+    else if( (size_t) buf->res < r->bufsize ) // short: the file ended, or the kernel stopped early
+      buf->len = fill( r, buf, buf->res );
+    else
+      buf->len = buf->res;
+    buf->state = RD_READY;
+    r->pos = 0;
+  }
+  return buf;
+} // ready
+#endif
+
+ssize_t
+rd_read( reader_t *r, char *dst, size_t len ) {
+  if( r->mode == RD_PREAD ) { // no read ahead
+    ssize_t rd;
+    long start = now( );
+    while( (rd = pread( r->fd, dst, len, r->next )) < 0 && errno == EINTR )
+      ;
+    if( rd < 0 )
+      errno_abort( "read input file" );
+    r->readns += now( ) - start;
+    r->next += rd;
+    r->bytes += rd;
+    r->reads++;
+    return rd;
+  }
+  if( r->mode == RD_THREAD ) {
+    for( ; ; ) {
+      if( !r->chunk.line ) { // take the next full buffer
+	if( !ring_get( &r->full, &r->chunk ) ) {
+	  r->chunk.line = NULL;
+	  return 0; // the file has ended
+	}
+	r->stalls = r->full.cwakeups; // we're the only one who waits on 'full'
+	r->pos = 0;
+      }
+      if( r->pos < r->chunk.len ) { // copy out what's left of it
+	size_t n = r->chunk.len - r->pos < len ? r->chunk.len - r->pos : len;
+	memcpy( dst, r->chunk.line + r->pos, n );
+	r->pos += n;
+	return n;
+      }
+      ring_put( &r->empty, &r->chunk ); // used up: back on the free list
+      r->chunk.line = NULL;
+    }
+  }
+#ifdef HAVE_URING
+  for( ; ; ) {
+    rdbuf_t *buf = ready( r );
+    if( r->pos < buf->len ) { // copy out what's left of it
+      size_t n = buf->len - r->pos < len ? buf->len - r->pos : len;
+      memcpy( dst, buf->data + r->pos, n );
+      r->pos += n;
+      return n;
+    }
+    if( buf->len < r->bufsize ) // the file ended in this buffer
+      return 0;
+    submit( r, r->cur ); // used up: read ahead into it, and go on to the next one
+    r->cur = ( r->cur + 1 ) % r->depth;
+  }
+#else
+  return 0;
+#endif
+} // rd_read
+
+ssize_t
+rd_next( reader_t *r, char **data ) {
+  if( r->ended )
+    return 0;
+  if( r->mode == RD_PREAD ) { // read into a buffer of our own
+    if( !r->bufs[0].data && !( r->bufs[0].data = malloc( r->bufsize ) ) )
+      errno_abort( "allocate read buffer" );
+    rdbuf_t *buf = &r->bufs[0];
+    buf->off = r->next;
+    r->reads++;
+    buf->len = fill( r, buf, 0 );
+    r->next += buf->len;
+    if( buf->len == 0 )
+      r->ended = true;
+    *data = buf->data;
+    return buf->len;
+  }
+  if( r->mode == RD_THREAD ) {
+    for( ; ; ) {
+      if( !ring_get( &r->full, &r->chunk ) ) {
+	r->chunk.line = NULL;
+	r->ended = true;
+	return 0; // the file has ended
+      }
+      r->stalls = r->full.cwakeups; // we're the only one who waits on 'full'
+      if( r->chunk.len > 0 )
+	break;
+      ring_put( &r->empty, &r->chunk ); // nothing in it: the file ended right at a buffer's end
+    }
+    r->lent = true;
+    *data = r->chunk.line;
+    return r->chunk.len;
+  }
+#ifdef HAVE_URING
+  rdbuf_t *buf = ready( r );
+  if( buf->len == 0 ) {
+    r->ended = true;
+    return 0;
+  }
+  r->lent = true;
+  *data = buf->data;
+  return buf->len;
+#else
+  return 0;
+#endif
+} // rd_next
+
+void
+rd_release( reader_t *r ) {
+  if( !r->lent )
+    return;
+  r->lent = false;
+  if( r->mode == RD_THREAD ) {
+    ring_put( &r->empty, &r->chunk ); // back on the free list
+    r->chunk.line = NULL;
+  }
+#ifdef HAVE_URING
+  else if( r->mode == RD_URING ) {
+    if( r->bufs[r->cur].len < r->bufsize ) { // the file ended in this buffer
+      r->ended = true;
+      return;
+    }
+    submit( r, r->cur ); // read ahead into it, and go on to the next one
+    r->cur = ( r->cur + 1 ) % r->depth;
+  }
+#endif
+} // rd_release
+
+const char *
+rd_kind( const reader_t *r ) {
+  return r->mode == RD_PREAD ? "pread" : r->mode == RD_THREAD ? "reader thread"
+    : r->fixed ? "io_uring (fixed buffers)" : "io_uring";
+} // rd_kind
@@ -0,0 +1,117 @@
+// a read-ahead reader: keeps several large reads of a file in flight
+// (with io_uring, or with a thread of its own), and hands their data out front to back, like read(2)
+
+#ifndef __reader_h
+#define __reader_h
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "ring.h"
+
+/*
+  *) the producer of proNconQ.c reads a buffer, splits it into lines, and only then reads
+     the next one, so the disk sits idle while it splits, and it sits idle while the disk reads;
+
+  *) in RD_URING mode, a reader owns 'depth' buffers of 'bufsize' bytes, registered with
+     the kernel once (so that a read doesn't have to map its buffer), and keeps a read
+     into each of them in flight through an io_uring, set up with the raw system calls;
+     rd_read() copies out of the oldest buffer, and once that is used up, hands it
+     straight back to the kernel for the next read ahead of the others;
+
+  *) a read that comes back short is completed with pread(2), and a read that fails
+     is done again with pread(2), so the data always comes out whole and in order;
+
+  *) in RD_THREAD mode, the reads are done by a reader thread of its own instead,
+     with plain read(2)s (as in lecture05/lowio.c), so the reading, the splitting and
+     the consuming are three stages that run at the same time: the thread takes an empty
+     buffer off the free list 'empty', fills it, and puts it on 'full'; rd_read() copies
+     out of the buffers on 'full', and puts each one back on 'empty' once it is used up;
+     both are rings (see ring.h), so each side sleeps when it gets ahead of the other,
+     and the rings' wakeup counts tell which side that was;
+
+  *) in RD_PREAD mode, or where there is no io_uring (an old kernel, or one that
+     forbids it), rd_read() is just a pread(2) straight into the caller's buffer;
+     with PCNOURING set in the environment, RD_URING falls back to it as if there were none;
+
+  *) rd_read() copies every byte once more, out of the reader's buffer into the caller's;
+     rd_next() lends the caller the next buffer as it is instead, and rd_release() gives it
+     back to be read into again (in RD_PREAD mode, the buffer is one of the reader's own that
+     each rd_next() preads into); proNconQ.c splits the lines right in the lent buffer,
+     while the reads of the buffers behind it go on; rd_read() and rd_next() don't mix;
+
+  *) 'reads' counts the reads issued, 'bytes' the bytes read, and 'stalls' the times rd_read()
+     had to wait for a read to complete: stalls close to reads mean the disk is the bottleneck;
+     'readns' is the time spent in pread(2)s and read(2)s (the reads of io_uring take
+     no time of ours)
+*/
+
+enum rd_mode {
+  RD_PREAD,   // read when asked to
+  RD_URING,   // read ahead with io_uring
+  RD_THREAD,  // read ahead with a reader thread
+};
+
+#define RD_MAXDEPTH 16  // most reads in flight
+
+enum rd_state { RD_IDLE, RD_INFLIGHT, RD_DONE, RD_READY };
+
+typedef struct rdbuf {
+  char *data;          // 'bufsize' bytes
+  off_t off;           // offset in the file the buffer was read from
+  size_t len;          // bytes in the buffer
+  int res;             // result of the read (bytes or -errno)
+  enum rd_state state; // where the buffer is
+} rdbuf_t;
+
+typedef struct reader {
+  int fd;              // the file
+  size_t bufsize;      // size of a read
+  enum rd_mode mode;   // how the file is read
+  int depth;           // reads in flight (0: plain pread)
+  off_t next;          // where the next read starts
+  int cur;             // buffer being copied out of
+  size_t pos;          // bytes of it copied out already
+  int inflight;        // reads the kernel hasn't completed yet
+  bool fixed;          // the buffers are registered
+  rdbuf_t bufs[RD_MAXDEPTH];
+  // the io_uring
+  int ring;            // its file descriptor (-1: none)
+  void *sqmap, *cqmap; // the submission and completion rings
+  size_t sqsize, cqsize;
+  struct io_uring_sqe *sqes; // the submission queue entries
+  unsigned sqentries;
+  unsigned *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe *cqes;
+  // the reader thread
+  pthread_t thread;    // fills the buffers
+  ring_t empty;        // buffers to fill (their index in 'linenum')
+  ring_t full;         // buffers filled (their index in 'linenum', their bytes in 'len')
+  line_t chunk;        // the buffer being copied out of ('line' == NULL: none)
+  bool lent;           // rd_next() lent a buffer out
+  bool ended;          // rd_next() has seen the end of the file
+  // statistics
+  unsigned long reads; // reads issued
+  unsigned long bytes; // bytes read
+  unsigned long stalls; // times we waited for a read
+  long readns;         // time spent in pread(2)/read(2)
+} reader_t;
+
+// read file 'fd' in pieces of 'bufsize' bytes, with 'depth' reads in flight ('mode' != RD_PREAD)
+void rd_init( reader_t *r, int fd, size_t bufsize, enum rd_mode mode, int depth );
+// wait for the reads in flight, and free the buffers
+void rd_destroy( reader_t *r );
+// copy up to 'len' bytes of the file into 'dst'; return the number of bytes copied,
+// 0 at the end of the file
+ssize_t rd_read( reader_t *r, char *dst, size_t len );
+// lend the caller the next buffer of the file: point '*data' at it and return
+// the number of bytes in it, 0 at the end of the file; it is the caller's until rd_release()
+ssize_t rd_next( reader_t *r, char **data );
+// give back the buffer rd_next() lent out
+void rd_release( reader_t *r );
+// how the file is being read: "io_uring", "io_uring (fixed buffers)", "reader thread", or "pread"
+const char *rd_kind( const reader_t *r );
+
+#endif // __reader_h
@@ -0,0 +1,89 @@
+// an ordered sink with a bounded reorder window
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "errors.h"
+#include "reorder.h"
+
+void
+ro_init( reorder_t *r, FILE *stream, size_t window, long first ) {
+  int rc;
+  if( window == 0 )
+    window = 1;
+  if( !( r->slots = calloc( window, sizeof(roslot_t) ) ) )
+    errno_abort( "allocate reorder window" );
+  r->stream = stream;
+  r->window = window;
+  r->next = first;
+  r->held = r->maxheld = r->waiting = 0;
+  r->waits = 0;
+  if( (rc = pthread_mutex_init( &r->lock, NULL )) != 0 )
+    err_abort( rc, "mutex init" );
+  if( (rc = pthread_cond_init( &r->moved, NULL )) != 0 )
+    err_abort( rc, "moved init" );
+} // ro_init
+
+void
+ro_destroy( reorder_t *r ) {
+  int rc;
+  if( r->held > 0 )
+    fprintf( stderr, "reorder: %zu records never written (line %ld missing)\n", r->held, r->next );
+  if( fflush( r->stream ) != 0 )
+    errno_abort( "write output" );
+  for( size_t s = 0; s < r->window; ++s )
+    free( r->slots[s].text );
+  free( r->slots );
+  r->slots = NULL;
+  if( (rc = pthread_mutex_destroy( &r->lock )) != 0 )
+    err_abort( rc, "destroy mutex" );
+  if( (rc = pthread_cond_destroy( &r->moved )) != 0 )
+    err_abort( rc, "destroy moved" );
+} // ro_destroy
+
+void
+ro_put( reorder_t *r, long linenum, const char *text, size_t len ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( &r->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  if( linenum >= r->next + (long) r->window ) { // wait for the window to move up to us
+    r->waits++;
+    r->waiting++;
+    while( linenum >= r->next + (long) r->window )
+      if( (rc = pthread_cond_wait( &r->moved, &r->lock )) != 0 )
+	err_abort( rc, "wait moved" );
+    r->waiting--;
+  }
+  // we're holding the lock AND our slot is free
+  long before = r->next;
+  if( linenum == r->next ) { // ours is next: no need to hold it back
+    if( fwrite( text, 1, len, r->stream ) != len )
+      errno_abort( "write output" );
+    r->next++;
+  }
+  else {
+    roslot_t *s = &r->slots[linenum % r->window];
+    if( s->cap < len ) {
+      s->cap = len > 2 * s->cap ? len : 2 * s->cap;
+      if( !( s->text = realloc( s->text, s->cap ) ) )
+	errno_abort( "grow reorder slot" );
+    }
+    memcpy( s->text, text, len );
+    s->len = len;
+    s->ready = true;
+    if( ++r->held > r->maxheld )
+      r->maxheld = r->held;
+  }
+  // write whatever has been waiting for us
+  for( roslot_t *s; ( s = &r->slots[r->next % r->window] )->ready; r->next++ ) {
+    if( fwrite( s->text, 1, s->len, r->stream ) != s->len )
+      errno_abort( "write output" );
+    s->ready = false;
+    r->held--;
+  }
+  if( r->waiting > 0 && r->next != before )
+    pthread_cond_broadcast( &r->moved );
+  if( (rc = pthread_mutex_unlock( &r->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+} // ro_put
@@ -0,0 +1,62 @@
+// an ordered sink: records come in from several threads in any order,
+// and go out in the order of their line numbers
+
+#ifndef __reorder_h
+#define __reorder_h
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) the sink holds the records of the 'window' line numbers starting at 'next',
+     the next one to be written; the record of line 'n' goes into slot 'n % window';
+
+  *) 'lock' is a mutex that locks the whole sink;
+
+  *) a thread with the record of line 'next' writes it, and then every record
+     after it that is already there, and moves 'next' past them; a thread with
+     a record beyond the window waits on 'moved' until 'next' has caught up,
+     so memory use is bounded by the window, not by the size of the input;
+
+  *) that wait is safe only if the thread with line 'next' is never itself
+     waiting on the waiter: it is, if lines are handed out in order (a FIFO queue,
+     a one-line buffer) and every thread emits its lines in the order it took them;
+     it is not, if lines can be overtaken (work stealing, several producers);
+
+  *) 'waits' counts the times a thread had to wait for the window to move,
+     and 'maxheld' is the most records ever held back at the same time
+*/
+
+typedef struct roslot {
+  char *text;   // the record
+  size_t len;   // its length
+  size_t cap;   // room in 'text'
+  bool ready;   // the record is there
+} roslot_t;
+
+typedef struct reorder {
+  FILE *stream;          // where the records go
+  roslot_t *slots;       // 'window' slots
+  size_t window;         // line numbers held at most
+  long next;             // line number of the next record to write
+  size_t held;           // records held back
+  size_t maxheld;        // most records ever held back
+  size_t waiting;        // threads waiting on 'moved'
+  unsigned long waits;   // times a thread waited for the window to move
+  pthread_mutex_t lock;  // mutex for the sink
+  pthread_cond_t moved;  // conditional variable for 'next' has moved
+} reorder_t;
+
+// initialize a sink of 'window' slots that writes to 'stream', starting at line 'first'
+void ro_init( reorder_t *r, FILE *stream, size_t window, long first );
+// destroy the sink (all the records must have been written)
+void ro_destroy( reorder_t *r );
+// hand over the record 'text' ('len' bytes) of line 'linenum';
+// wait if 'linenum' is beyond the window
+void ro_put( reorder_t *r, long linenum, const char *text, size_t len );
+
+#endif // __reorder_h
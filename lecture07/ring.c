@@ -0,0 +1,184 @@
+// a bounded ring buffer of line slots with a mutex and 2 conditional variables
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "errors.h"
+#include "ring.h"
+
+void
+ring_init( ring_t *r, size_t cap ) {
+  int rc;
+  if( cap == 0 )
+    cap = 1;
+  if( !( r->slots = malloc( cap * sizeof(line_t) ) ) )
+    errno_abort( "allocate ring slots" );
+  r->cap = cap;
+  r->head = r->tail = r->count = 0;
+  r->closed = false;
+  r->high = cap;
+  r->low = cap - 1;
+  r->waiting = r->pwaiting = 0;
+  r->locks = r->lines = 0;
+  r->pwakeups = r->cwakeups = 0;
+  if( (rc = pthread_mutex_init( &r->lock, NULL )) != 0 )
+    err_abort( rc, "mutex init" );
+  pthread_condattr_t attr; // timed waits on 'notempty' count monotonic time
+  if( (rc = pthread_condattr_init( &attr )) != 0 )
+    err_abort( rc, "condattr init" );
+  if( (rc = pthread_condattr_setclock( &attr, CLOCK_MONOTONIC )) != 0 )
+    err_abort( rc, "condattr setclock" );
+  if( (rc = pthread_cond_init( &r->notempty, &attr )) != 0 )
+    err_abort( rc, "notempty init" );
+  pthread_condattr_destroy( &attr );
+  if( (rc = pthread_cond_init( &r->notfull, NULL )) != 0 )
+    err_abort( rc, "notfull init" );
+} // ring_init
+
+void
+ring_marks( ring_t *r, size_t high, size_t low ) {
+  if( high == 0 || high > r->cap )
+    high = r->cap;
+  if( low >= high )
+    low = high - 1;
+  r->high = high;
+  r->low = low;
+} // ring_marks
+
+void
+ring_destroy( ring_t *r ) {
+  int rc;
+  if( (rc = pthread_mutex_destroy( &r->lock )) != 0 )
+    err_abort( rc, "destroy mutex" );
+  if( (rc = pthread_cond_destroy( &r->notempty )) != 0 )
+    err_abort( rc, "destroy notempty" );
+  if( (rc = pthread_cond_destroy( &r->notfull )) != 0 )
+    err_abort( rc, "destroy notfull" );
+  free( r->slots );
+  r->slots = NULL;
+} // ring_destroy
+
+void
+ring_put( ring_t *r, const line_t *item ) {
+  ring_put_batch( r, item, 1 );
+} // ring_put
+
+bool
+ring_get( ring_t *r, line_t *item ) {
+  return ring_get_batch( r, item, 1 ) == 1;
+} // ring_get
+
+void
+ring_put_batch( ring_t *r, const line_t *items, size_t n ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( &r->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  r->locks++;
+  while( n > 0 ) {
+    if( r->count >= r->high ) { // wait for the consumers to drain the ring down to 'low'
+      r->pwaiting++;
+      while( r->count > r->low ) {
+	if( (rc = pthread_cond_wait( &r->notfull, &r->lock )) != 0 )
+	  err_abort( rc, "wait notfull" );
+	r->locks++;
+	r->pwakeups++;
+      }
+      r->pwaiting--;
+    }
+    // we're holding the lock AND there is room below 'high'
+    size_t put = 0;
+    for( ; put < n && r->count < r->high; ++put, ++r->count ) {
+      r->slots[r->tail] = items[put];
+      r->tail = ( r->tail + 1 ) % r->cap;
+    }
+    items += put;
+    n -= put;
+    r->lines += put;
+    if( r->waiting > 0 ) { // wake up as many consumers as there are lines for
+      if( put > 1 )
+	pthread_cond_broadcast( &r->notempty );
+      else
+	pthread_cond_signal( &r->notempty );
+    }
+  } // while
+  if( (rc = pthread_mutex_unlock( &r->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+} // ring_put_batch
+
+size_t
+ring_get_batch( ring_t *r, line_t *items, size_t max ) {
+  return ring_get_batch_wait( r, items, max, -1, NULL );
+} // ring_get_batch
+
+size_t
+ring_get_batch_wait( ring_t *r, line_t *items, size_t max, long nsec, bool *timedout ) {
+  int rc;
+  size_t got = 0;
+  struct timespec deadline;
+  if( timedout )
+    *timedout = false;
+  if( nsec >= 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    deadline.tv_sec += ( deadline.tv_nsec + nsec ) / 1000000000L;
+    deadline.tv_nsec = ( deadline.tv_nsec + nsec ) % 1000000000L;
+  }
+  if( (rc = pthread_mutex_lock( &r->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  r->locks++;
+  while( r->count == 0 && !r->closed ) { // wait for a line
+    r->waiting++;
+    if( nsec < 0 )
+      rc = pthread_cond_wait( &r->notempty, &r->lock );
+    else
+      rc = pthread_cond_timedwait( &r->notempty, &r->lock, &deadline );
+    r->waiting--;
+    r->locks++;
+    if( rc == ETIMEDOUT ) {
+      if( r->count == 0 && !r->closed ) { // nothing came: give up
+	*timedout = true;
+	break;
+      }
+    }
+    else if( rc != 0 )
+      err_abort( rc, "wait notempty" );
+    else
+      r->cwakeups++;
+  }
+  // we're holding the lock AND there are lines or no more lines will come;
+  // leave the consumers that are still waiting their share
+  size_t share = ( r->count + r->waiting ) / ( r->waiting + 1 );
+  if( max > share )
+    max = share;
+  for( ; got < max; ++got, --r->count ) {
+    items[got] = r->slots[r->head];
+    r->head = ( r->head + 1 ) % r->cap;
+  }
+  // wake up the producers if they're waiting and we took the ring down to 'low'
+  if( r->pwaiting > 0 && r->count <= r->low && r->count + got > r->low )
+    pthread_cond_broadcast( &r->notfull );
+  if( (rc = pthread_mutex_unlock( &r->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+  return got;
+} // ring_get_batch
+
+size_t
+ring_count( ring_t *r ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( &r->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  size_t count = r->count;
+  if( (rc = pthread_mutex_unlock( &r->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+  return count;
+} // ring_count
+
+void
+ring_close( ring_t *r ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( &r->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  r->closed = true;
+  pthread_cond_broadcast( &r->notempty ); // let all consumers see 'closed'
+  if( (rc = pthread_mutex_unlock( &r->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+} // ring_close
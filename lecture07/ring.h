@@ -0,0 +1,95 @@
+// a bounded ring buffer of line slots shared by
+// producer and consumer threads
+
+#ifndef __ring_h
+#define __ring_h
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "line.h"
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) the ring holds up to 'cap' lines; 'head' is the next slot to take a line from,
+     'tail' is the next free slot, and 'count' is the number of lines in the ring;
+
+  *) 'lock' is a mutex that locks the whole ring;
+
+  *) two condition variables replace the single 'flag' of proNcon2CV.c:
+
+    -- notempty:
+       producer -> consumers : there is at least one line, so go ahead and take it
+
+    -- notfull:
+       consumers -> producer : there is at least one free slot, so go ahead and fill it
+
+  *) 'closed' is set by the producer once there are no more lines;
+     consumers drain the ring and then quit;
+
+  *) ring_put_batch() and ring_get_batch() move a whole batch of lines
+     per lock acquisition; a consumer takes at most its fair share
+     of the lines in the ring, so that the consumers waiting behind it get some too;
+
+  *) the producers fill the ring up to the high watermark 'high' and then sleep on 'notfull'
+     until the consumers have drained it down to the low watermark 'low'; only the consumer
+     that takes the ring down to 'low' wakes them up, so a producer that keeps the ring
+     full wakes up once per 'high - low' lines rather than once per line;
+     by default 'high' is 'cap' and 'low' is 'cap - 1' (wait for any free slot);
+
+  *) 'locks' and 'lines' count lock acquisitions and lines put, so that
+     the lock traffic per line can be reported, and 'pwakeups' and 'cwakeups'
+     count the times producers and consumers came back from waiting;
+
+  *) ring_get_batch_wait() gives up waiting after a while, so that a consumer
+     can tell that it has been idle for that long (see proNconQ.c)
+*/
+
+// the ring buffer
+typedef struct ring {
+  line_t *slots;            // 'cap' line slots
+  size_t cap;               // capacity of the ring
+  size_t head;              // next slot to take a line from
+  size_t tail;              // next slot to put a line into
+  size_t count;             // number of lines in the ring
+  bool closed;              // no more lines will be put
+  size_t high;              // producers wait once the ring holds 'high' lines
+  size_t low;               // ... until it holds no more than 'low'
+  size_t waiting;           // consumers waiting on 'notempty'
+  size_t pwaiting;          // producers waiting on 'notfull'
+  unsigned long locks;      // lock acquisitions so far
+  unsigned long lines;      // lines put so far
+  unsigned long pwakeups;   // times producers woke up on 'notfull'
+  unsigned long cwakeups;   // times consumers woke up on 'notempty'
+  pthread_mutex_t lock;     // mutex for the ring
+  pthread_cond_t notempty;  // conditional variable for 'count > 0'
+  pthread_cond_t notfull;   // conditional variable for 'count <= low'
+} ring_t;
+
+// initialize a ring with 'cap' slots
+void ring_init( ring_t *r, size_t cap );
+// set the watermarks: put lines until there are 'high', then wait until there are 'low'
+// (0 < high <= cap, low < high; out-of-range values are clamped)
+void ring_marks( ring_t *r, size_t high, size_t low );
+// destroy the ring (does not free the lines in it)
+void ring_destroy( ring_t *r );
+// wait for a free slot and put a line into it
+void ring_put( ring_t *r, const line_t *item );
+// wait for a line and take it out of the ring;
+// return false if the ring is closed and empty
+bool ring_get( ring_t *r, line_t *item );
+// put 'n' lines into the ring, waiting for free slots as needed
+void ring_put_batch( ring_t *r, const line_t *items, size_t n );
+// wait for lines and take up to 'max' of them out of the ring;
+// return the number of lines taken, 0 if the ring is closed and empty
+size_t ring_get_batch( ring_t *r, line_t *items, size_t max );
+// same, but wait no longer than 'nsec' ns for a line (< 0: forever); if none came,
+// return 0 with '*timedout' set (rather than 0 for a ring that is closed and empty)
+size_t ring_get_batch_wait( ring_t *r, line_t *items, size_t max, long nsec, bool *timedout );
+// the number of lines in the ring right now
+size_t ring_count( ring_t *r );
+// mark the ring as closed and wake everybody up
+void ring_close( ring_t *r );
+
+#endif // __ring_h
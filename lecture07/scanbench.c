@@ -0,0 +1,116 @@
+// a micro-benchmark of line splitting alone:
+// split a file that is already in memory into lines
+// with fgets() + strnlen() and with every linescan() implementation,
+// and report bytes per second
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "errors.h"
+#include "linescan.h"
+
+#define MAXLINE 1000
+#define NUM_SPANS 1024  // spans per linescan() call
+#define NUM_ROUNDS 5    // times to split the file with each method
+
+// wall-clock time in seconds
+static double
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+} // now
+
+// split with fgets() + strnlen(), the way readline() does
+static size_t
+split_fgets( char *buf, size_t n, size_t *bytes ) {
+  FILE *mfile = fmemopen( buf, n, "r" );
+  if( !mfile )
+    errno_abort( "fmemopen" );
+  char line[MAXLINE];
+  size_t lines = 0;
+  *bytes = 0;
+  while( fgets( line, MAXLINE, mfile ) ) {
+    *bytes += strnlen( line, MAXLINE );
+    ++lines;
+  }
+  fclose( mfile );
+  return lines;
+} // split_fgets
+
+// split with linescan()
+static size_t
+split_linescan( char *buf, size_t n, size_t *bytes ) {
+  static span_t spans[NUM_SPANS];
+  size_t lines = 0, pos = 0, used, found;
+  *bytes = 0;
+  while( (found = linescan( buf + pos, n - pos, spans, NUM_SPANS, &used )) > 0 ) {
+    lines += found;
+    for( size_t i = 0; i < found; ++i )
+      *bytes += spans[i].len;
+    pos += used;
+  }
+  if( pos < n ) { // the last line lacks a '\n'
+    *bytes += n - pos;
+    ++lines;
+  }
+  return lines;
+} // split_linescan
+
+int
+main( int argc, char *argv[] ) {
+
+  // check use
+  if( argc < 2 ){
+    fprintf( stderr, "Usage: %s filename\n", argv[0] );
+    exit( EXIT_FAILURE );
+  }
+
+  // read the whole file into memory
+  int fd = open( argv[1], O_RDONLY );
+  struct stat st;
+  if( fd < 0 || fstat( fd, &st ) != 0 )
+    errno_abort( "open input file" );
+  size_t n = st.st_size;
+  char *buf = malloc( n + 1 );
+  if( !buf )
+    errno_abort( "allocate buffer" );
+  for( size_t got = 0; got < n; ) {
+    ssize_t rd = read( fd, buf + got, n - got );
+    if( rd <= 0 )
+      errno_abort( "read input file" );
+    got += rd;
+  }
+  close( fd );
+
+  const char *names[] = { "fgets", "scalar", "sse2", "avx2" };
+  printf( "%-8s %12s %14s %10s %12s\n", "method", "lines", "bytes", "seconds", "MB/sec" );
+  for( size_t m = 0; m < sizeof(names) / sizeof(names[0]); ++m ) {
+    bool fgetsmode = m == 0;
+    if( !fgetsmode && !linescan_select( names[m] ) ) {
+      printf( "%-8s (not supported by this CPU)\n", names[m] );
+      continue;
+    }
+    size_t lines = 0, bytes = 0;
+    double best = 1e30;
+    for( int r = 0; r < NUM_ROUNDS; ++r ) {
+      double start = now( );
+      lines = fgetsmode ? split_fgets( buf, n, &bytes ) : split_linescan( buf, n, &bytes );
+      double secs = now( ) - start;
+      if( secs < best )
+	best = secs;
+    }
+    if( bytes != n )
+      fprintf( stderr, "%s: lost bytes!\n", names[m] );
+    printf( "%-8s %12zu %14zu %10.3f %12.1f\n", names[m], lines, bytes, best, n / best / 1e6 );
+  } // for
+
+  free( buf );
+  exit( EXIT_SUCCESS );
+
+} // main
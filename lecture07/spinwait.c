@@ -0,0 +1,112 @@
+// an adaptive wait: spin a little, then yield, then sleep on a futex
+
+#include <stdio.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include "errors.h"
+#include "spinwait.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause( )
+#else
+#define cpu_relax() atomic_signal_fence( memory_order_seq_cst )
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// sleep as long as '*addr == val' (and nobody wakes us up)
+static void
+futex_wait( atomic_uint *addr, unsigned val ) {
+  if( syscall( SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0 ) != 0
+      && errno != EAGAIN && errno != EINTR )
+    errno_abort( "futex wait" );
+} // futex_wait
+
+// wake up everybody asleep on 'addr'
+static void
+futex_wake( atomic_uint *addr ) {
+  if( syscall( SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0 ) < 0 )
+    errno_abort( "futex wake" );
+} // futex_wake
+#else
+// no futexes: sleeping is just more yielding
+static void
+futex_wait( atomic_uint *addr, unsigned val ) {
+  (void) addr, (void) val;
+  sched_yield( );
+} // futex_wait
+
+static void
+futex_wake( atomic_uint *addr ) {
+  (void) addr;
+} // futex_wake
+#endif // __linux__
+
+void
+sw_init( spinwait_t *w ) {
+  atomic_init( &w->seq, 0 );
+  atomic_init( &w->sleepers, 0 );
+  atomic_init( &w->budget, SW_MINSPIN * 4 );
+  atomic_init( &w->spun, 0 );
+  atomic_init( &w->yielded, 0 );
+  atomic_init( &w->parked, 0 );
+} // sw_init
+
+void
+sw_wait( spinwait_t *w, bool (*pred)( void * ), void *arg ) {
+  unsigned budget = atomic_load_explicit( &w->budget, memory_order_relaxed );
+  // spin
+  for( unsigned i = 0; i < budget; ++i ) {
+    if( pred( arg ) ) {
+      if( 2 * i > budget && budget < SW_MAXSPIN ) // just made it: spin longer next time
+	atomic_store_explicit( &w->budget, 2 * budget, memory_order_relaxed );
+      atomic_fetch_add_explicit( &w->spun, 1, memory_order_relaxed );
+      return;
+    }
+    cpu_relax( );
+  }
+  // spinning didn't pay off this time: spin less next time
+  if( budget > SW_MINSPIN )
+    atomic_store_explicit( &w->budget, budget / 2, memory_order_relaxed );
+  // yield
+  for( int y = 0; y < SW_YIELDS; ++y ) {
+    sched_yield( );
+    if( pred( arg ) ) {
+      atomic_fetch_add_explicit( &w->yielded, 1, memory_order_relaxed );
+      return;
+    }
+  }
+  // sleep
+  for( ; ; ) {
+    unsigned seq = atomic_load( &w->seq );
+    atomic_fetch_add( &w->sleepers, 1 ); // from now on, sw_wake() bumps 'seq' ...
+    bool ok = pred( arg );               // ... so if this misses the wakeup ...
+    if( !ok )
+      futex_wait( &w->seq, seq );        // ... this doesn't sleep
+    atomic_fetch_sub( &w->sleepers, 1 );
+    if( ok || pred( arg ) )
+      break;
+  }
+  atomic_fetch_add_explicit( &w->parked, 1, memory_order_relaxed );
+} // sw_wait
+
+void
+sw_wake( spinwait_t *w ) {
+  // order the caller's stores that made the condition true before the load of 'sleepers'
+  atomic_thread_fence( memory_order_seq_cst );
+  if( atomic_load_explicit( &w->sleepers, memory_order_relaxed ) > 0 ) {
+    atomic_fetch_add( &w->seq, 1 );
+    futex_wake( &w->seq );
+  }
+} // sw_wake
+
+void
+sw_report( spinwait_t *w, const char *who ) {
+  printf( "%s: waits: %lu spun, %lu yielded, %lu slept (spin budget %u)\n", who,
+	  atomic_load( &w->spun ), atomic_load( &w->yielded ), atomic_load( &w->parked ),
+	  atomic_load( &w->budget ) );
+} // sw_report
@@ -0,0 +1,60 @@
+// an adaptive wait: spin a little, then yield, then sleep on a futex
+
+#ifndef __spinwait_h
+#define __spinwait_h
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifndef CACHELINE
+#define CACHELINE 64  // size of a cache line in bytes
+#endif
+
+/*
+  *) spinning without end (waittill() in proNcon.c, markfull() in procon_flag.c)
+     burns a whole CPU per waiting thread, and once there are more threads than CPUs,
+     the spinner may well be keeping the very thread it waits for off the CPU;
+     sleeping right away (pthread_cond_wait()) costs two context switches per handoff
+     even when the other side would have been done in a few hundred cycles;
+
+  *) sw_wait() does both: it first polls the condition up to 'budget' times,
+     with a PAUSE in between (cheap on the CPU, and it lets a hyperthread sibling run),
+     then gives up the CPU SW_YIELDS times, and only then goes to sleep on the futex 'seq';
+
+  *) the spin budget adapts to the handoff latency it observes: a wait that succeeds
+     in the second half of its budget doubles it (up to SW_MAXSPIN), and a wait that
+     has to yield or sleep halves it (down to SW_MINSPIN), so spinning only goes on
+     for as long as it has been paying off;
+
+  *) the condition is a function 'pred(arg)'; it may also be an attempt
+     (to pop a line, to take a lock) that has an effect only when it succeeds;
+
+  *) whoever makes the condition true calls sw_wake(); that is a fence and a load
+     unless somebody is asleep ('sleepers' > 0), and only then a futex system call;
+     a sleeper counts itself in 'sleepers' before it checks the condition one last time,
+     and sw_wake() bumps 'seq' before it wakes anybody, so no wakeup is lost
+*/
+
+#define SW_MINSPIN 16    // least number of polls before yielding
+#define SW_MAXSPIN 8192  // most number of polls before yielding
+#define SW_YIELDS 4      // sched_yield()s before going to sleep
+
+typedef struct spinwait {
+  _Alignas(CACHELINE) atomic_uint seq;  // futex word, bumped by every sw_wake() that finds sleepers
+  atomic_int sleepers;   // threads asleep on 'seq' (or about to be)
+  atomic_uint budget;    // polls before yielding
+  _Alignas(CACHELINE) atomic_ulong spun;  // waits that ended while spinning
+  atomic_ulong yielded;  // waits that ended while yielding
+  atomic_ulong parked;   // waits that had to sleep
+} spinwait_t;
+
+// initialize a wait
+void sw_init( spinwait_t *w );
+// wait until 'pred(arg)' returns true
+void sw_wait( spinwait_t *w, bool (*pred)( void * ), void *arg );
+// the condition may have become true: wake up whoever is asleep in sw_wait()
+void sw_wake( spinwait_t *w );
+// print how the waits ended to stdout, after 'who'
+void sw_report( spinwait_t *w, const char *who );
+
+#endif // __spinwait_h
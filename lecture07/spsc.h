@@ -0,0 +1,93 @@
+// a lock-free single-producer/single-consumer ring of lines
+// built on C11 atomics
+
+#ifndef __spsc_h
+#define __spsc_h
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "errors.h"
+#include "line.h"
+
+#ifndef CACHELINE
+#define CACHELINE 64  // size of a cache line in bytes
+#endif
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) 'tail' is written only by the producer and 'head' only by the consumer;
+     each of them only reads the other's index, so no lock is needed;
+
+  *) the producer fills slot 'tail' and then publishes it with a release store
+     of 'tail + 1'; the consumer's acquire load of 'tail' therefore sees the slot's contents
+     (and symmetrically for 'head', which hands the slot back to the producer);
+
+  *) 'head' and 'tail' live on cache lines of their own, so that the producer's
+     stores do not invalidate the line the consumer is reading (and vice versa);
+     each side also keeps a private copy of the other side's index and only
+     re-reads the shared one when the ring looks full (or empty)
+*/
+
+typedef struct spsc {
+  // consumer-owned
+  _Alignas(CACHELINE) atomic_size_t head;  // next slot to take a line from
+  size_t tailcache;                        // consumer's last view of 'tail'
+  // producer-owned
+  _Alignas(CACHELINE) atomic_size_t tail;  // next slot to put a line into
+  size_t headcache;                        // producer's last view of 'head'
+  // read-mostly
+  _Alignas(CACHELINE) size_t mask;         // capacity - 1 (capacity is a power of 2)
+  line_t *slots;
+} spsc_t;
+
+// initialize a ring with at least 'cap' slots
+static inline void
+spsc_init( spsc_t *q, size_t cap ) {
+  size_t n = 2;
+  while( n < cap )
+    n <<= 1;
+  if( !( q->slots = malloc( n * sizeof(line_t) ) ) )
+    errno_abort( "allocate spsc slots" );
+  q->mask = n - 1;
+  atomic_init( &q->head, 0 );
+  atomic_init( &q->tail, 0 );
+  q->tailcache = q->headcache = 0;
+} // spsc_init
+
+static inline void
+spsc_destroy( spsc_t *q ) {
+  free( q->slots );
+  q->slots = NULL;
+} // spsc_destroy
+
+// producer side: put a line into the ring; return false if it is full
+static inline bool
+spsc_push( spsc_t *q, const line_t *item ) {
+  size_t tail = atomic_load_explicit( &q->tail, memory_order_relaxed );
+  if( tail - q->headcache > q->mask ) { // looks full: refresh our view of 'head'
+    q->headcache = atomic_load_explicit( &q->head, memory_order_acquire );
+    if( tail - q->headcache > q->mask )
+      return false;
+  }
+  q->slots[tail & q->mask] = *item;
+  atomic_store_explicit( &q->tail, tail + 1, memory_order_release ); // publish the slot
+  return true;
+} // spsc_push
+
+// consumer side: take a line out of the ring; return false if it is empty
+static inline bool
+spsc_pop( spsc_t *q, line_t *item ) {
+  size_t head = atomic_load_explicit( &q->head, memory_order_relaxed );
+  if( head == q->tailcache ) { // looks empty: refresh our view of 'tail'
+    q->tailcache = atomic_load_explicit( &q->tail, memory_order_acquire );
+    if( head == q->tailcache )
+      return false;
+  }
+  *item = q->slots[head & q->mask];
+  atomic_store_explicit( &q->head, head + 1, memory_order_release ); // hand the slot back
+  return true;
+} // spsc_pop
+
+#endif // __spsc_h
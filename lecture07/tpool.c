@@ -0,0 +1,158 @@
+// a pool of worker threads with a task queue, a mutex and 2 conditional variables
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "errors.h"
+#include "tpool.h"
+
+#define TP_CAP 16  // task slots to start with
+
+// what a worker does: run tasks until the pool is closed and the queue is empty
+static void *
+worker( void *arg ) {
+  int rc;
+  tpool_t *tp = arg;
+  if( (rc = pthread_mutex_lock( &tp->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  for( ; ; ) {
+    while( tp->count == 0 && !tp->closed )
+      if( (rc = pthread_cond_wait( &tp->notempty, &tp->lock )) != 0 )
+	err_abort( rc, "wait for a task" );
+    if( tp->count == 0 ) // closed and empty: we're done
+      break;
+    tp_task_t task = tp->tasks[tp->head];
+    tp->head = ( tp->head + 1 ) % tp->cap;
+    tp->count--;
+    if( (rc = pthread_mutex_unlock( &tp->lock )) != 0 )
+      err_abort( rc, "unlock mutex" );
+
+    void *result = task.fn( task.arg );
+
+    if( (rc = pthread_mutex_lock( &tp->lock )) != 0 )
+      err_abort( rc, "lock mutex" );
+    if( task.future ) {
+      task.future->result = result;
+      task.future->done = true;
+    }
+    tp->pending--;
+    tp->ran++;
+    // whoever waits for this task, or for all of them, has a look
+    if( (rc = pthread_cond_broadcast( &tp->finished )) != 0 )
+      err_abort( rc, "broadcast finished" );
+  }
+  if( (rc = pthread_mutex_unlock( &tp->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+  return NULL;
+} // worker
+
+void
+tp_init( tpool_t *tp, int n, const affinity_t *a ) {
+  int rc;
+  if( n < 1 )
+    n = 1;
+  tp->n = n;
+  tp->cap = TP_CAP;
+  tp->head = tp->count = tp->pending = 0;
+  tp->closed = false;
+  tp->ran = 0;
+  if( !( tp->tasks = malloc( tp->cap * sizeof(tp_task_t) ) ) || !( tp->workers = malloc( n * sizeof(pthread_t) ) ) )
+    errno_abort( "allocate pool" );
+  if( (rc = pthread_mutex_init( &tp->lock, NULL )) != 0 )
+    err_abort( rc, "mutex init" );
+  if( (rc = pthread_cond_init( &tp->notempty, NULL )) != 0 )
+    err_abort( rc, "notempty init" );
+  if( (rc = pthread_cond_init( &tp->finished, NULL )) != 0 )
+    err_abort( rc, "finished init" );
+  pthread_attr_t attr; // where a worker runs
+  for( int i = 0; i < n; ++i ) {
+    if( (rc = pthread_attr_init( &attr )) != 0 )
+      err_abort( rc, "attr init" );
+    if( a )
+      af_attr( a, i, &attr );
+    if( (rc = pthread_create( &tp->workers[i], &attr, worker, tp )) != 0 )
+      err_abort( rc, "create worker thread" );
+    pthread_attr_destroy( &attr );
+  }
+} // tp_init
+
+void
+tp_destroy( tpool_t *tp ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( &tp->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  tp->closed = true;
+  if( (rc = pthread_cond_broadcast( &tp->notempty )) != 0 ) // wake up all workers
+    err_abort( rc, "broadcast notempty" );
+  if( (rc = pthread_mutex_unlock( &tp->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+  for( int i = 0; i < tp->n; ++i )
+    if( (rc = pthread_join( tp->workers[i], NULL )) != 0 )
+      err_abort( rc, "join worker thread" );
+  if( (rc = pthread_mutex_destroy( &tp->lock )) != 0 )
+    err_abort( rc, "destroy mutex" );
+  if( (rc = pthread_cond_destroy( &tp->notempty )) != 0 )
+    err_abort( rc, "destroy notempty" );
+  if( (rc = pthread_cond_destroy( &tp->finished )) != 0 )
+    err_abort( rc, "destroy finished" );
+  free( tp->tasks );
+  free( tp->workers );
+  tp->tasks = NULL;
+  tp->workers = NULL;
+} // tp_destroy
+
+void
+tp_submit( tpool_t *tp, void *(*fn)( void * ), void *arg, tp_future_t *f ) {
+  int rc;
+  if( f ) {
+    f->done = false;
+    f->result = NULL;
+  }
+  if( (rc = pthread_mutex_lock( &tp->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  if( tp->count == tp->cap ) { // the queue is full: double it, and straighten out the wrap-around
+    tp_task_t *tasks = malloc( 2 * tp->cap * sizeof(tp_task_t) );
+    if( !tasks )
+      errno_abort( "grow task queue" );
+    for( size_t i = 0; i < tp->count; ++i )
+      tasks[i] = tp->tasks[( tp->head + i ) % tp->cap];
+    free( tp->tasks );
+    tp->tasks = tasks;
+    tp->cap *= 2;
+    tp->head = 0;
+  }
+  tp_task_t *task = &tp->tasks[( tp->head + tp->count ) % tp->cap];
+  task->fn = fn;
+  task->arg = arg;
+  task->future = f;
+  tp->count++;
+  tp->pending++;
+  if( (rc = pthread_cond_signal( &tp->notempty )) != 0 ) // one task, one worker
+    err_abort( rc, "signal notempty" );
+  if( (rc = pthread_mutex_unlock( &tp->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+} // tp_submit
+
+void *
+tp_wait( tpool_t *tp, tp_future_t *f ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( &tp->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  while( !f->done )
+    if( (rc = pthread_cond_wait( &tp->finished, &tp->lock )) != 0 )
+      err_abort( rc, "wait for a task to finish" );
+  if( (rc = pthread_mutex_unlock( &tp->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+  return f->result;
+} // tp_wait
+
+void
+tp_wait_all( tpool_t *tp ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( &tp->lock )) != 0 )
+    err_abort( rc, "lock mutex" );
+  while( tp->pending > 0 )
+    if( (rc = pthread_cond_wait( &tp->finished, &tp->lock )) != 0 )
+      err_abort( rc, "wait for the tasks to finish" );
+  if( (rc = pthread_mutex_unlock( &tp->lock )) != 0 )
+    err_abort( rc, "unlock mutex" );
+} // tp_wait_all
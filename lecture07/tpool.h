@@ -0,0 +1,82 @@
+// a pool of worker threads that run the tasks submitted to it,
+// so that a program pays for pthread_create() once, not once per task
+
+#ifndef __tpool_h
+#define __tpool_h
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "affinity.h"
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) pthreads0.c (lecture06) creates a thread per piece of work and lets it exit;
+     here tp_init() creates 'n' workers once, and they run task after task
+     until tp_destroy() sends them home;
+
+  *) a task is a function and its argument, like the start routine of a thread;
+     tp_submit() appends it to the queue 'tasks' (a ring that grows as needed,
+     so submitting never blocks) and a worker takes it from the front;
+
+  *) 'lock' is a mutex that locks the whole pool, and two condition variables go with it:
+
+    -- notempty:
+       tp_submit() -> workers : there is a task in the queue, so go ahead and run it
+
+    -- finished:
+       workers -> tp_wait(), tp_wait_all() : a task is done, so see if it is the one you wait for
+
+  *) tp_submit() fills in a future, if it is given one: the caller's handle on the task;
+     tp_wait() waits for the task to finish and returns what its function returned;
+     the future belongs to the caller, and must stay put until the task has finished;
+     a task submitted without a future is fire-and-forget;
+
+  *) 'pending' counts the tasks submitted and not finished yet: tp_wait_all() waits
+     for it to drop to 0;
+
+  *) 'closed' is set by tp_destroy(): the workers run what is left in the queue and quit
+*/
+
+// a task in the queue
+typedef struct tp_task {
+  void *(*fn)( void *arg );  // what to run
+  void *arg;                 // ... and with what
+  struct tp_future *future;  // where the result goes (NULL: nowhere)
+} tp_task_t;
+
+// the caller's handle on a submitted task
+typedef struct tp_future {
+  bool done;                 // the task has finished
+  void *result;              // what its function returned
+} tp_future_t;
+
+// the pool
+typedef struct tpool {
+  int n;                     // number of workers
+  pthread_t *workers;        // the workers
+  tp_task_t *tasks;          // 'cap' task slots
+  size_t cap;                // capacity of the queue
+  size_t head;               // next task to run
+  size_t count;              // number of tasks in the queue
+  size_t pending;            // tasks submitted and not finished
+  bool closed;               // no more tasks will be submitted
+  unsigned long ran;         // tasks run so far
+  pthread_mutex_t lock;      // mutex for the pool
+  pthread_cond_t notempty;   // conditional variable for 'count > 0'
+  pthread_cond_t finished;   // conditional variable for "a task is done"
+} tpool_t;
+
+// start a pool of 'n' workers, placed by 'a' (NULL: wherever the kernel likes)
+void tp_init( tpool_t *tp, int n, const affinity_t *a );
+// run what is left in the queue, stop the workers and destroy the pool
+void tp_destroy( tpool_t *tp );
+// queue 'fn( arg )' to be run by a worker, and make 'f' (if not NULL) its handle
+void tp_submit( tpool_t *tp, void *(*fn)( void * ), void *arg, tp_future_t *f );
+// wait for the task of 'f' to finish and return what it returned
+void *tp_wait( tpool_t *tp, tp_future_t *f );
+// wait for all tasks submitted so far to finish
+void tp_wait_all( tpool_t *tp );
+
+#endif // __tpool_h
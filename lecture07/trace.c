@@ -0,0 +1,105 @@
+// a per-thread event tracer that writes a Chrome trace
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include "errors.h"
+#include "trace.h"
+
+_Thread_local tr_ring_t *tr_self;
+int tr_mask = TR_SAMPLE - 1;
+
+static const char *path;     // where to write the trace (NULL: not tracing)
+static tr_ring_t *rings;     // every thread's ring
+static int nrings;           // how many
+static pthread_mutex_t ringlock = PTHREAD_MUTEX_INITIALIZER;  // mutex for 'rings'
+static uint64_t tick0;       // tr_clock() at tr_init()
+static long ns0;             // CLOCK_MONOTONIC at tr_init()
+
+static const char *names[] = { "produce", "consume", "wait", "woke", "signal" };
+
+static long
+now( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+} // now
+
+void
+tr_init( void ) {
+  path = getenv( "PCTRACE" );
+  const char *sample = getenv( "PCTRACE_SAMPLE" );
+  if( sample ) { // one line in 'n', rounded down to a power of 2
+    long n = atol( sample ), p = 1;
+    while( p * 2 <= n && p < ( 1L << 30 ) )
+      p *= 2;
+    tr_mask = (int) p - 1;
+  }
+  tick0 = tr_clock( );
+  ns0 = now( );
+} // tr_init
+
+void
+tr_thread( const char *fmt, ... ) {
+  if( !path )
+    return;
+  tr_ring_t *r = calloc( 1, sizeof(tr_ring_t) );
+  if( !r || !( r->events = malloc( TR_EVENTS * sizeof(tr_event_t) ) ) )
+    errno_abort( "allocate trace ring" );
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( r->name, sizeof(r->name), fmt, ap );
+  va_end( ap );
+  pthread_mutex_lock( &ringlock );
+  r->tid = ++nrings;
+  r->next = rings;
+  rings = r;
+  pthread_mutex_unlock( &ringlock );
+  tr_self = r;
+} // tr_thread
+
+void
+tr_dump( void ) {
+  if( !path )
+    return;
+  // nanoseconds per tick, from the clocks at tr_init() and now
+  uint64_t ticks = tr_clock( ) - tick0;
+  double nspertick = ticks ? (double) ( now( ) - ns0 ) / ticks : 1.0;
+
+  FILE *f = fopen( path, "w" );
+  if( !f )
+    errno_abort( "open trace file" );
+  fprintf( f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+  bool first = true;
+  pthread_mutex_lock( &ringlock );
+  while( rings ) {
+    tr_ring_t *r = rings;
+    rings = r->next;
+    fprintf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+	     first ? "" : ",\n", r->tid, r->name );
+    first = false;
+    // the ring holds the last TR_EVENTS events
+    uint64_t start = r->n > TR_EVENTS ? r->n - TR_EVENTS : 0;
+    for( uint64_t i = start; i < r->n; ++i ) {
+      tr_event_t *e = &r->events[i & ( TR_EVENTS - 1 )];
+      double us = (double) (int64_t) ( e->ts - tick0 ) * nspertick / 1000.0;
+      const char *ph = e->kind == TR_WAIT ? "B" : e->kind == TR_WOKE ? "E" : "i";
+      fprintf( f, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+	       e->kind == TR_WOKE ? names[TR_WAIT] : names[e->kind], ph, us, r->tid );
+      if( *ph == 'i' )
+	fprintf( f, ",\"s\":\"t\",\"args\":{\"line\":%d}", e->arg );
+      fprintf( f, "}" );
+    }
+    free( r->events );
+    free( r );
+  }
+  nrings = 0;
+  pthread_mutex_unlock( &ringlock );
+  fprintf( f, "\n]}\n" );
+  if( fclose( f ) != 0 )
+    errno_abort( "write trace file" );
+} // tr_dump
@@ -0,0 +1,99 @@
+// a per-thread event tracer that writes a Chrome trace (chrome://tracing, ui.perfetto.dev)
+
+#ifndef __trace_h
+#define __trace_h
+
+#include <stdint.h>
+
+/*
+  *) if the environment variable PCTRACE names a file, tr_init() turns tracing on;
+     every thread that calls tr_thread() gets a ring of TR_EVENTS events of its own,
+     and tr_event() appends to the calling thread's ring: no locks, no atomics,
+     nothing shared, just a time stamp and two stores (a full ring overwrites its oldest events);
+
+  *) the time stamp is the TSC where there is one (calibrated against CLOCK_MONOTONIC
+     between tr_init() and tr_dump()), and clock_gettime() elsewhere;
+
+  *) tr_dump(), called once the threads are joined, writes every ring to the file
+     as Chrome trace JSON: a wait is a slice from TR_WAIT to TR_WOKE, the other events
+     are instants that carry their line number;
+
+  *) waits, wakeups and signals are all recorded, but the produce and consume events
+     that come with every line go through tr_line(), which records those of one line
+     in TR_SAMPLE only (PCTRACE_SAMPLE=n in the environment: one in n, rounded down to
+     a power of 2; 1 records them all); the sample is picked by line number, so the
+     producer and the consumers record the same lines, and the trace still shows
+     how long those took to get across; that keeps the tracer's cost per line down
+     to a few percent of a handoff;
+
+  *) without PCTRACE, tr_event() is a test of a thread-local NULL pointer
+*/
+
+#define TR_EVENTS ( 1 << 16 )  // events per thread (a power of 2)
+#define TR_SAMPLE 64           // lines per line traced by default (a power of 2)
+
+enum tr_kind {
+  TR_PRODUCE,  // the producer handed over line 'arg'
+  TR_CONSUME,  // a consumer took line 'arg'
+  TR_WAIT,     // we start to wait
+  TR_WOKE,     // ... and we're done waiting
+  TR_SIGNAL,   // we signaled a condition
+};
+
+typedef struct tr_event {
+  uint64_t ts;    // time stamp in ticks
+  int32_t kind;   // enum tr_kind
+  int32_t arg;    // line number (or -1)
+} tr_event_t;
+
+typedef struct tr_ring {
+  tr_event_t *events;    // TR_EVENTS of them
+  uint64_t n;            // events recorded so far
+  char name[32];         // whose events
+  int tid;               // thread id in the trace
+  struct tr_ring *next;  // all the rings
+} tr_ring_t;
+
+extern _Thread_local tr_ring_t *tr_self;  // the calling thread's ring (NULL: not tracing)
+extern int tr_mask;  // a line is traced if its number & 'tr_mask' is 0
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t tr_clock( void ) { return __rdtsc( ); }
+#else
+#include <time.h>
+static inline uint64_t
+tr_clock( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+// start tracing if PCTRACE is set
+void tr_init( void );
+// give the calling thread a ring of its own, named after 'fmt' (printf style)
+void tr_thread( const char *fmt, ... );
+// write all the rings to the file named by PCTRACE, and free them
+void tr_dump( void );
+
+// record an event of kind 'kind' about line 'arg'
+static inline void
+tr_event( int kind, int arg ) {
+  tr_ring_t *r = tr_self;
+  if( r ) {
+    tr_event_t *e = &r->events[r->n++ & ( TR_EVENTS - 1 )];
+    e->ts = tr_clock( );
+    e->kind = kind;
+    e->arg = arg;
+  }
+} // tr_event
+
+// record an event of kind 'kind' about line 'linenum', if it is one of the sampled lines
+static inline void
+tr_line( int kind, int linenum ) {
+  if( tr_self && ( linenum & tr_mask ) == 0 )
+    tr_event( kind, linenum );
+} // tr_line
+
+#endif // __trace_h
@@ -0,0 +1,295 @@
+// the built-in work functions for consumers
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <regex.h>
+#include <pthread.h>
+#include "errors.h"
+#include "work.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+static void *
+zalloc( size_t size ) {
+  void *p = calloc( 1, size );
+  if( !p )
+    errno_abort( "allocate work context" );
+  return p;
+} // zalloc
+
+static void
+release( void *ctx ) {
+  free( ctx );
+} // release
+
+// ---- len -------------------------------------------------------------------
+
+typedef struct { size_t bytes; } len_t;
+
+static void *
+len_init( const char *arg ) {
+  (void) arg;
+  return zalloc( sizeof(len_t) );
+} // len_init
+
+static void
+len_line( void *ctx, const char *line, size_t len ) {
+  (void) line;
+  ( (len_t *) ctx )->bytes += len;
+} // len_line
+
+static void
+len_report( void *ctx, char *buf, size_t size ) {
+  snprintf( buf, size, "%zu bytes", ( (len_t *) ctx )->bytes );
+} // len_report
+
+// ---- crc32c ----------------------------------------------------------------
+
+#define CRC32C_POLY 0x82F63B78  // the Castagnoli polynomial, bit-reversed
+
+typedef uint32_t (*crcfun_t)( uint32_t, const char *, size_t );
+
+typedef struct {
+  crcfun_t fun;    // the implementation in use
+  long rounds;     // times to checksum every line
+  uint32_t sum;    // XOR of the checksums of all the lines
+} crc_t;
+
+static uint32_t crctab[256];
+static pthread_once_t crconce = PTHREAD_ONCE_INIT;
+
+static void
+crc_maketable( void ) {
+  for( uint32_t i = 0; i < 256; ++i ) {
+    uint32_t crc = i;
+    for( int k = 0; k < 8; ++k )
+      crc = crc & 1 ? ( crc >> 1 ) ^ CRC32C_POLY : crc >> 1;
+    crctab[i] = crc;
+  }
+} // crc_maketable
+
+// one byte at a time, through a table
+static uint32_t
+crc_table( uint32_t crc, const char *p, size_t n ) {
+  while( n-- )
+    crc = crctab[( crc ^ (unsigned char) *p++ ) & 0xff] ^ ( crc >> 8 );
+  return crc;
+} // crc_table
+
+#ifdef HAVE_X86
+// eight bytes at a time, with the SSE4.2 instruction
+__attribute__(( target( "sse4.2" ) ))
+static uint32_t
+crc_sse42( uint32_t crc, const char *p, size_t n ) {
+  uint64_t c = crc;
+  for( ; n >= 8; p += 8, n -= 8 ) {
+    uint64_t v;
+    memcpy( &v, p, 8 );
+    c = _mm_crc32_u64( c, v );
+  }
+  crc = (uint32_t) c;
+  while( n-- )
+    crc = _mm_crc32_u8( crc, (unsigned char) *p++ );
+  return crc;
+} // crc_sse42
+#endif // HAVE_X86
+
+static void *
+crc_init( const char *arg ) {
+  crc_t *c = zalloc( sizeof(crc_t) );
+  c->rounds = arg ? atol( arg ) : 1;
+  if( c->rounds < 1 )
+    c->rounds = 1;
+  c->fun = crc_table;
+#ifdef HAVE_X86
+  __builtin_cpu_init( );
+  if( __builtin_cpu_supports( "sse4.2" ) )
+    c->fun = crc_sse42;
+#endif
+  if( c->fun == crc_table ) // the table is the same for every thread
+    pthread_once( &crconce, crc_maketable );
+  return c;
+} // crc_init
+
+static void
+crc_line( void *ctx, const char *line, size_t len ) {
+  crc_t *c = ctx;
+  uint32_t crc = 0;
+  for( long r = 0; r < c->rounds; ++r ) // each round checksums the previous checksum too
+    crc = ~c->fun( ~crc, line, len );
+  c->sum ^= crc;
+} // crc_line
+
+static void
+crc_report( void *ctx, char *buf, size_t size ) {
+  crc_t *c = ctx;
+  snprintf( buf, size, "crc32c %08x (%s)", c->sum, c->fun == crc_table ? "table" : "sse4.2" );
+} // crc_report
+
+// ---- skew ------------------------------------------------------------------
+
+// like crc32c, but one line in SKEW_EVERY (picked by its checksum) takes 'rounds' rounds,
+// the others one round: a workload where a few lines cost far more than the rest
+#define SKEW_EVERY 16
+
+static void *
+skew_init( const char *arg ) {
+  crc_t *c = crc_init( NULL );
+  c->rounds = arg ? atol( arg ) : 1000;
+  if( c->rounds < 1 )
+    c->rounds = 1;
+  return c;
+} // skew_init
+
+static void
+skew_line( void *ctx, const char *line, size_t len ) {
+  crc_t *c = ctx;
+  uint32_t crc = ~c->fun( ~0u, line, len );
+  if( crc % SKEW_EVERY == 0 )
+    for( long r = 1; r < c->rounds; ++r )
+      crc = ~c->fun( ~crc, line, len );
+  c->sum ^= crc;
+} // skew_line
+
+// ---- wc --------------------------------------------------------------------
+
+typedef struct { size_t lines, words, bytes; } wc_t;
+
+static void *
+wc_init( const char *arg ) {
+  (void) arg;
+  return zalloc( sizeof(wc_t) );
+} // wc_init
+
+static void
+wc_line( void *ctx, const char *line, size_t len ) {
+  wc_t *w = ctx;
+  bool inword = false;
+  for( size_t i = 0; i < len; ++i ) {
+    bool space = isspace( (unsigned char) line[i] );
+    if( !space && !inword )
+      w->words += 1;
+    inword = !space;
+  }
+  w->lines += 1;
+  w->bytes += len;
+} // wc_line
+
+static void
+wc_report( void *ctx, char *buf, size_t size ) {
+  wc_t *w = ctx;
+  snprintf( buf, size, "%zu lines %zu words %zu bytes", w->lines, w->words, w->bytes );
+} // wc_report
+
+// ---- grep ------------------------------------------------------------------
+
+typedef struct {
+  const char *text;  // what to look for
+  size_t len;
+  size_t matches;    // lines that contain it
+} grep_t;
+
+static void *
+grep_init( const char *arg ) {
+  if( !arg || !*arg ) {
+    fprintf( stderr, "grep: no text to look for (use grep:text)\n" );
+    exit( EXIT_FAILURE );
+  }
+  grep_t *g = zalloc( sizeof(grep_t) );
+  g->text = arg;
+  g->len = strlen( arg );
+  return g;
+} // grep_init
+
+static void
+grep_line( void *ctx, const char *line, size_t len ) {
+  grep_t *g = ctx;
+  if( memmem( line, len, g->text, g->len ) )
+    g->matches += 1;
+} // grep_line
+
+static void
+grep_report( void *ctx, char *buf, size_t size ) {
+  snprintf( buf, size, "%zu matching lines", ( (grep_t *) ctx )->matches );
+} // grep_report
+
+// ---- regex -----------------------------------------------------------------
+
+typedef struct {
+  regex_t re;
+  size_t matches;  // lines that match
+} regex_ctx_t;
+
+static void *
+regex_init( const char *arg ) {
+  if( !arg || !*arg ) {
+    fprintf( stderr, "regex: no regular expression (use regex:re)\n" );
+    exit( EXIT_FAILURE );
+  }
+  regex_ctx_t *r = zalloc( sizeof(regex_ctx_t) );
+  int status = regcomp( &r->re, arg, REG_EXTENDED | REG_NOSUB | REG_NEWLINE );
+  if( status != 0 ) {
+    char msg[256];
+    regerror( status, &r->re, msg, sizeof(msg) );
+    fprintf( stderr, "regex '%s': %s\n", arg, msg );
+    exit( EXIT_FAILURE );
+  }
+  return r;
+} // regex_init
+
+static void
+regex_line( void *ctx, const char *line, size_t len ) {
+  regex_ctx_t *r = ctx;
+  // the line need not end in '\0': give regexec() its bounds instead
+  regmatch_t bounds = { .rm_so = 0, .rm_eo = (regoff_t) len };
+  if( regexec( &r->re, line, 1, &bounds, REG_STARTEND ) == 0 )
+    r->matches += 1;
+} // regex_line
+
+static void
+regex_report( void *ctx, char *buf, size_t size ) {
+  snprintf( buf, size, "%zu matching lines", ( (regex_ctx_t *) ctx )->matches );
+} // regex_report
+
+static void
+regex_fini( void *ctx ) {
+  regfree( &( (regex_ctx_t *) ctx )->re );
+  free( ctx );
+} // regex_fini
+
+// ----------------------------------------------------------------------------
+
+static const work_t works[] = {
+  { "len", len_init, len_line, len_report, release },
+  { "crc32c", crc_init, crc_line, crc_report, release },
+  { "skew", skew_init, skew_line, crc_report, release },
+  { "wc", wc_init, wc_line, wc_report, release },
+  { "grep", grep_init, grep_line, grep_report, release },
+  { "regex", regex_init, regex_line, regex_report, regex_fini },
+};
+
+const work_t *
+work_lookup( const char *spec, const char **arg ) {
+  const char *colon = strchr( spec, ':' );
+  size_t n = colon ? (size_t) ( colon - spec ) : strlen( spec );
+  for( size_t i = 0; i < sizeof(works) / sizeof(works[0]); ++i )
+    if( strlen( works[i].name ) == n && strncmp( spec, works[i].name, n ) == 0 ) {
+      *arg = colon ? colon + 1 : NULL;
+      return &works[i];
+    }
+  return NULL;
+} // work_lookup
+
+void
+work_list( FILE *stream ) {
+  for( size_t i = 0; i < sizeof(works) / sizeof(works[0]); ++i )
+    fprintf( stream, "%s%s", i ? " " : "", works[i].name );
+  fprintf( stream, "\n" );
+} // work_list
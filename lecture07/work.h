@@ -0,0 +1,42 @@
+// the work a consumer does with each line
+
+#ifndef __work_h
+#define __work_h
+
+#include <stdio.h>
+
+/*
+  *) a work function is a set of callbacks: init() sets up a context for a consumer thread,
+     line() is called for every line the consumer takes, report() describes
+     what the consumer found, and fini() frees the context;
+
+  *) each consumer has a context of its own, so the work needs no locking;
+
+  *) lines are (pointer, length) pairs and need not end in '\0'
+
+  the built-in work functions are
+    len            add up the lengths of the lines (what the consumers always did)
+    crc32c[:n]     checksum every line with CRC32C, n times over (to dial up the cost per line);
+                   the checksums are XOR-ed together, so the result doesn't depend on the order
+    skew[:n]       like crc32c, but one line in 16 (picked by its checksum) takes n rounds
+                   (1000 by default) and the rest one: a few lines cost far more than the others
+    wc             count lines, words and bytes, like wc(1)
+    grep:text      count the lines that contain 'text'
+    regex:re       count the lines that match the extended regular expression 're'
+*/
+
+typedef struct work {
+  const char *name;                                      // name for '-w'
+  void *(*init)( const char *arg );                      // make a context (arg may be NULL)
+  void (*line)( void *ctx, const char *line, size_t len ); // do the work for one line
+  void (*report)( void *ctx, char *buf, size_t size );   // describe the result in 'buf'
+  void (*fini)( void *ctx );                             // free the context
+} work_t;
+
+// find the work function for 'spec' ("name" or "name:arg") and store the 'arg' part in 'arg'
+// return NULL if there is no such work function
+const work_t *work_lookup( const char *spec, const char **arg );
+// print the names of the built-in work functions to 'stream'
+void work_list( FILE *stream );
+
+#endif // __work_h
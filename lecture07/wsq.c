@@ -0,0 +1,168 @@
+// work-stealing queues: one deque of lines per consumer, each with a mutex of its own
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "errors.h"
+#include "wsq.h"
+
+void
+wsq_init( wsq_t *q, int n, size_t cap ) {
+  int rc;
+  if( cap == 0 )
+    cap = 1;
+  q->n = n;
+  if( !( q->deques = aligned_alloc( CACHELINE, n * sizeof(wsdeque_t) ) ) )
+    errno_abort( "allocate deques" );
+  for( int c = 0; c < n; ++c ) {
+    wsdeque_t *d = &q->deques[c];
+    if( !( d->slots = malloc( cap * sizeof(line_t) ) ) )
+      errno_abort( "allocate deque slots" );
+    d->cap = cap;
+    d->head = d->count = 0;
+    d->steals = d->stolen = 0;
+    if( (rc = pthread_mutex_init( &d->lock, NULL )) != 0 )
+      err_abort( rc, "mutex init" );
+  }
+  atomic_init( &q->queued, 0 );
+  atomic_init( &q->idle, 0 );
+  atomic_init( &q->pwaiting, 0 );
+  atomic_init( &q->closed, false );
+  if( (rc = pthread_mutex_init( &q->lock, NULL )) != 0 )
+    err_abort( rc, "mutex init" );
+  if( (rc = pthread_cond_init( &q->notempty, NULL )) != 0 )
+    err_abort( rc, "notempty init" );
+  if( (rc = pthread_cond_init( &q->notfull, NULL )) != 0 )
+    err_abort( rc, "notfull init" );
+} // wsq_init
+
+void
+wsq_destroy( wsq_t *q ) {
+  int rc;
+  for( int c = 0; c < q->n; ++c ) {
+    if( (rc = pthread_mutex_destroy( &q->deques[c].lock )) != 0 )
+      err_abort( rc, "destroy mutex" );
+    free( q->deques[c].slots );
+  }
+  free( q->deques );
+  q->deques = NULL;
+  if( (rc = pthread_mutex_destroy( &q->lock )) != 0 )
+    err_abort( rc, "destroy mutex" );
+  if( (rc = pthread_cond_destroy( &q->notempty )) != 0 )
+    err_abort( rc, "destroy notempty" );
+  if( (rc = pthread_cond_destroy( &q->notfull )) != 0 )
+    err_abort( rc, "destroy notfull" );
+} // wsq_destroy
+
+static void
+lock( pthread_mutex_t *m ) {
+  int rc;
+  if( (rc = pthread_mutex_lock( m )) != 0 )
+    err_abort( rc, "lock mutex" );
+} // lock
+
+static void
+unlock( pthread_mutex_t *m ) {
+  int rc;
+  if( (rc = pthread_mutex_unlock( m )) != 0 )
+    err_abort( rc, "unlock mutex" );
+} // unlock
+
+// wake up whoever is parked on 'cond' (if anybody is: 'waiting')
+static void
+wake( wsq_t *q, atomic_int *waiting, pthread_cond_t *cond ) {
+  if( atomic_load( waiting ) > 0 ) {
+    lock( &q->lock );
+    pthread_cond_broadcast( cond );
+    unlock( &q->lock );
+  }
+} // wake
+
+int
+wsq_put( wsq_t *q, int c, const line_t *items, size_t n ) {
+  int rc;
+  size_t full = q->n * q->deques[0].cap; // lines in all deques when they are full
+  while( n > 0 ) {
+    size_t put = 0;
+    for( int k = 0; k < q->n && put == 0; ++k ) { // the first deque from 'c' on with room
+      wsdeque_t *d = &q->deques[( c + k ) % q->n];
+      lock( &d->lock );
+      for( ; put < n && d->count < d->cap; ++put, ++d->count )
+	d->slots[( d->head + d->count ) % d->cap] = items[put];
+      unlock( &d->lock );
+      if( put > 0 )
+	c = ( c + k ) % q->n;
+    }
+    if( put > 0 ) {
+      items += put;
+      n -= put;
+      atomic_fetch_add( &q->queued, put );
+      wake( q, &q->idle, &q->notempty );
+      continue;
+    }
+    // every deque is full: wait for a consumer to take some lines
+    atomic_fetch_add( &q->pwaiting, 1 );
+    lock( &q->lock );
+    while( atomic_load( &q->queued ) == full )
+      if( (rc = pthread_cond_wait( &q->notfull, &q->lock )) != 0 )
+	err_abort( rc, "wait notfull" );
+    unlock( &q->lock );
+    atomic_fetch_sub( &q->pwaiting, 1 );
+  } // while
+  return c;
+} // wsq_put
+
+size_t
+wsq_get( wsq_t *q, int c, line_t *items, size_t max ) {
+  int rc;
+  size_t got = 0;
+  wsdeque_t *own = &q->deques[c];
+  for( ; ; ) {
+    // our own lines first, from the front
+    lock( &own->lock );
+    for( ; got < max && own->count > 0; ++got, --own->count ) {
+      items[got] = own->slots[own->head];
+      own->head = ( own->head + 1 ) % own->cap;
+    }
+    unlock( &own->lock );
+    if( got > 0 )
+      break;
+    // then half of somebody else's, from the back
+    for( int k = 1; k < q->n && got == 0; ++k ) {
+      wsdeque_t *d = &q->deques[( c + k ) % q->n];
+      lock( &d->lock );
+      size_t take = ( d->count + 1 ) / 2;
+      if( take > max )
+	take = max;
+      for( ; got < take; ++got )
+	items[got] = d->slots[( d->head + d->count - take + got ) % d->cap];
+      d->count -= take;
+      unlock( &d->lock );
+    }
+    if( got > 0 ) {
+      own->steals++;
+      own->stolen += got;
+      break;
+    }
+    // nothing anywhere: are we done, or do we wait?
+    if( atomic_load( &q->closed ) && atomic_load( &q->queued ) == 0 )
+      return 0;
+    atomic_fetch_add( &q->idle, 1 );
+    lock( &q->lock );
+    while( atomic_load( &q->queued ) == 0 && !atomic_load( &q->closed ) )
+      if( (rc = pthread_cond_wait( &q->notempty, &q->lock )) != 0 )
+	err_abort( rc, "wait notempty" );
+    unlock( &q->lock );
+    atomic_fetch_sub( &q->idle, 1 );
+  } // for
+  atomic_fetch_sub( &q->queued, got );
+  wake( q, &q->pwaiting, &q->notfull );
+  return got;
+} // wsq_get
+
+void
+wsq_close( wsq_t *q ) {
+  atomic_store( &q->closed, true );
+  lock( &q->lock );
+  pthread_cond_broadcast( &q->notempty ); // let all consumers see 'closed'
+  unlock( &q->lock );
+} // wsq_close
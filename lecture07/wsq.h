@@ -0,0 +1,79 @@
+// work-stealing queues: one deque of lines per consumer,
+// and consumers that run out of lines steal from the others
+
+#ifndef __wsq_h
+#define __wsq_h
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "line.h"
+
+#ifndef CACHELINE
+#define CACHELINE 64  // size of a cache line in bytes
+#endif
+
+/*
+  COMMMUNICATION MODEL:
+
+  *) with a single shared buffer (or ring), every consumer waits on the same
+     condition variable, and which consumer gets the next line is up to the scheduler;
+     here every consumer has a deque of its own, and the producer deals the lines
+     out to the deques in batches, round robin;
+
+  *) a consumer takes lines from the front of its own deque; once that is empty,
+     it steals half of the lines at the back of another consumer's deque,
+     so a consumer that got stuck with expensive lines doesn't hold up the rest;
+
+  *) each deque has a mutex of its own, so the owner only contends with a thief
+     that happens to pick its deque, never with all the other consumers;
+
+  *) 'queued' counts the lines in all deques; a consumer that finds nothing
+     to steal parks on 'notempty', and the producer parks on 'notfull'
+     when the deque it deals to (and every other one) is full;
+     'idle' and 'pwaiting' tell the other side whether it needs to take 'lock' to wake anybody up
+     (each side updates its own counter before it checks the other side's, so no wakeup is lost);
+
+  *) 'closed' is set by the producer once there are no more lines;
+     consumers empty all the deques and then quit
+*/
+
+// the deque of one consumer
+typedef struct wsdeque {
+  _Alignas(CACHELINE) pthread_mutex_t lock;  // mutex for the deque
+  line_t *slots;        // 'cap' line slots
+  size_t cap;           // capacity of the deque
+  size_t head;          // front of the deque (the owner takes lines from here)
+  size_t count;         // number of lines in the deque
+  unsigned long steals; // batches stolen by the owner of this deque
+  unsigned long stolen; // lines stolen by the owner of this deque
+} wsdeque_t;
+
+// the deques of all consumers
+typedef struct wsq {
+  int n;                  // number of consumers (and deques)
+  wsdeque_t *deques;      // the deques
+  _Alignas(CACHELINE) atomic_size_t queued; // lines in all deques
+  atomic_int idle;        // consumers parked on 'notempty'
+  atomic_int pwaiting;    // producers parked on 'notfull'
+  atomic_bool closed;     // no more lines will be put
+  pthread_mutex_t lock;   // mutex for parking
+  pthread_cond_t notempty;  // conditional variable for 'queued > 0 || closed'
+  pthread_cond_t notfull;   // conditional variable for 'a deque has a free slot'
+} wsq_t;
+
+// initialize 'n' deques of 'cap' lines each
+void wsq_init( wsq_t *q, int n, size_t cap );
+// destroy the deques (does not free the lines in them)
+void wsq_destroy( wsq_t *q );
+// put 'n' lines at the back of deque 'c', or of the next deque with room,
+// waiting for room as needed; return the deque the last line went to
+int wsq_put( wsq_t *q, int c, const line_t *items, size_t n );
+// take up to 'max' lines for consumer 'c': from its own deque if it can, stolen otherwise;
+// wait for lines if there are none; return the number of lines taken, 0 if closed and empty
+size_t wsq_get( wsq_t *q, int c, line_t *items, size_t max );
+// mark the deques as closed and wake everybody up
+void wsq_close( wsq_t *q );
+
+#endif // __wsq_h